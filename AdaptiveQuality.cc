@@ -0,0 +1,104 @@
+#include "AdaptiveQuality.h"
+
+#include <algorithm>
+
+using namespace carta;
+
+AdaptiveQuality::AdaptiveQuality(double latencyTargetMs)
+    : latencyTarget(latencyTargetMs * 1e-3),
+      backlogBytes(0),
+      busyBytes(0),
+      bytesPerSecond(0),
+      bitsPerPixelBit(0),
+      refinementPending(false) {
+}
+
+void AdaptiveQuality::queued(size_t bytes, clock::time_point now) {
+    std::unique_lock<std::mutex> guard(mutex);
+    if (!backlogBytes) {
+        // link idle until now: start a busy period
+        busyStart = now;
+        busyBytes = 0;
+    }
+    backlogBytes += bytes;
+}
+
+void AdaptiveQuality::drained(size_t bytes, clock::time_point now) {
+    std::unique_lock<std::mutex> guard(mutex);
+    backlogBytes -= std::min(bytes, backlogBytes);
+    busyBytes += bytes;
+    double elapsed = std::max(std::chrono::duration<double>(now - busyStart).count(), 1e-3);
+    bool saturated = elapsed >= ADAPTIVE_SAMPLE_MS * 1e-3;
+    if (!saturated && backlogBytes) {
+        return;
+    }
+    double sample = busyBytes / elapsed;
+    if (saturated) {
+        // the link was the bottleneck for the whole sample
+        bytesPerSecond = bytesPerSecond > 0 ? 0.5 * (bytesPerSecond + sample) : sample;
+    } else {
+        // queue emptied early: the link is at least this fast
+        bytesPerSecond = std::max(bytesPerSecond, sample);
+    }
+    busyStart = now;
+    busyBytes = 0;
+}
+
+void AdaptiveQuality::dropped(size_t bytes) {
+    std::unique_lock<std::mutex> guard(mutex);
+    backlogBytes -= std::min(bytes, backlogBytes);
+}
+
+double AdaptiveQuality::throughput() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return bytesPerSecond;
+}
+
+size_t AdaptiveQuality::backlog() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return backlogBytes;
+}
+
+AdaptiveQuality::Settings AdaptiveQuality::choose(int requestedPrecision, size_t numPixels) {
+    std::unique_lock<std::mutex> guard(mutex);
+    Settings settings{requestedPrecision, 1, false};
+    if (bytesPerSecond <= 0 || bitsPerPixelBit <= 0) {
+        // nothing measured yet
+        return settings;
+    }
+    auto latency = [&](int precision, int mipFactor) {
+        double bytes = bitsPerPixelBit * precision * numPixels / (mipFactor * mipFactor) / 8;
+        return (backlogBytes + bytes) / bytesPerSecond;
+    };
+    // lower the precision first, then raise the mip
+    while (latency(settings.precision, settings.mipFactor) > latencyTarget) {
+        if (settings.precision - ADAPTIVE_PRECISION_STEP >= ADAPTIVE_MIN_PRECISION) {
+            settings.precision -= ADAPTIVE_PRECISION_STEP;
+        } else if (settings.mipFactor * 2 <= ADAPTIVE_MAX_MIP_FACTOR) {
+            settings.mipFactor *= 2;
+        } else {
+            break;
+        }
+    }
+    settings.degraded = (settings.precision != requestedPrecision || settings.mipFactor != 1);
+    return settings;
+}
+
+void AdaptiveQuality::frameSent(size_t numPixels, int precision, size_t bytes, bool degraded, clock::time_point now) {
+    std::unique_lock<std::mutex> guard(mutex);
+    if (numPixels && precision > 0) {
+        bitsPerPixelBit = 8.0 * bytes / (static_cast<double>(numPixels) * precision);
+    }
+    // a full-quality frame supersedes a pending refinement
+    refinementPending = degraded;
+    lastFrame = now;
+}
+
+bool AdaptiveQuality::refinementDue(clock::time_point now) {
+    std::unique_lock<std::mutex> guard(mutex);
+    if (refinementPending && now - lastFrame >= std::chrono::milliseconds(ADAPTIVE_REFINE_DELAY_MS)) {
+        refinementPending = false;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,59 @@
+//# AdaptiveQuality.h: measures outbound throughput of a session and picks the ZFP precision and
+//# mip of interactive raster frames to keep their latency under a target
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+
+#define ADAPTIVE_LATENCY_TARGET_MS 100 // raster frame latency target while panning or animating
+#define ADAPTIVE_MIN_PRECISION 8       // lowest ZFP precision used before the mip is raised
+#define ADAPTIVE_PRECISION_STEP 2
+#define ADAPTIVE_MAX_MIP_FACTOR 4      // mip of an interactive frame is at most 4x the requested mip
+#define ADAPTIVE_REFINE_DELAY_MS 300   // idle time before a degraded view is sent at full quality
+#define ADAPTIVE_SAMPLE_MS 100         // throughput sample interval while the link is busy
+#define ADAPTIVE_REFINE_CHECK_MS 100   // how often the server checks for views to refine
+
+namespace carta {
+
+class AdaptiveQuality {
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct Settings {
+        int precision;
+        int mipFactor; // multiplies the requested mip
+        bool degraded; // lower than requested: refine once the user stops
+    };
+
+    AdaptiveQuality(double latencyTargetMs = ADAPTIVE_LATENCY_TARGET_MS);
+
+    // Outbound accounting: bytes queued for the client, and bytes written to the socket
+    void queued(size_t bytes, clock::time_point now = clock::now());
+    void drained(size_t bytes, clock::time_point now = clock::now());
+    void dropped(size_t bytes); // dropped from the queue without being sent
+    double throughput(); // bytes/s while the link is busy; 0 until measured
+    size_t backlog();
+
+    // Settings for an interactive frame of numPixels at the requested mip and precision, from the
+    // compression ratio of previous frames and the measured throughput
+    Settings choose(int requestedPrecision, size_t numPixels);
+    // Records the compressed size of a frame sent; degraded frames schedule a refinement
+    void frameSent(size_t numPixels, int precision, size_t bytes, bool degraded, clock::time_point now = clock::now());
+    // True (once) when a degraded frame has not been followed by another frame for ADAPTIVE_REFINE_DELAY_MS
+    bool refinementDue(clock::time_point now = clock::now());
+
+private:
+    std::mutex mutex;
+    double latencyTarget; // seconds
+    size_t backlogBytes;
+    size_t busyBytes;     // drained since busyStart
+    clock::time_point busyStart;
+    double bytesPerSecond;
+    double bitsPerPixelBit; // compressed bits per pixel per bit of precision, from the last frame
+    bool refinementPending;
+    clock::time_point lastFrame;
+};
+
+} // namespace carta
@@ -0,0 +1,110 @@
+#include "AnimationPlayer.h"
+
+#include <algorithm>
+
+using namespace carta;
+
+AnimationPlayer::AnimationPlayer(const AnimationSettings& settings_, FrameCallback sendFrame_, int window_)
+    : settings(settings_),
+      sendFrame(std::move(sendFrame_)),
+      window(std::max(window_, 1)),
+      sent(0),
+      acked(0),
+      stopped(false),
+      done(false) {
+}
+
+AnimationPlayer::~AnimationPlayer() {
+    requestStop();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+void AnimationPlayer::start() {
+    if (!worker.joinable()) {
+        worker = std::thread(&AnimationPlayer::run, this);
+    }
+}
+
+void AnimationPlayer::requestStop() {
+    {
+        std::unique_lock<std::mutex> guard(mutex);
+        stopped = true;
+    }
+    changed.notify_all();
+}
+
+void AnimationPlayer::frameReceived() {
+    {
+        std::unique_lock<std::mutex> guard(mutex);
+        acked = std::min(acked + 1, sent);
+    }
+    changed.notify_all();
+}
+
+void AnimationPlayer::frameSkipped() {
+    {
+        std::unique_lock<std::mutex> guard(mutex);
+        sent = std::max(sent - 1, acked);
+    }
+    changed.notify_all();
+}
+
+bool AnimationPlayer::finished() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return stopped || done;
+}
+
+int AnimationPlayer::numSent() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return sent;
+}
+
+bool AnimationPlayer::nextChannel(const AnimationSettings& settings, int& channel, int& direction) {
+    int step = settings.deltaChannel * direction;
+    int next = channel + step;
+    if (next < settings.firstChannel || next > settings.lastChannel) {
+        switch (settings.mode) {
+            case PlaybackMode::LOOP:
+                next = step > 0 ? settings.firstChannel : settings.lastChannel;
+                break;
+            case PlaybackMode::BOUNCE:
+                direction = -direction;
+                next = channel - step;
+                if (next < settings.firstChannel || next > settings.lastChannel) {
+                    next = channel; // range of one step
+                }
+                break;
+            default:
+                return false;
+        }
+    }
+    channel = next;
+    return true;
+}
+
+void AnimationPlayer::run() {
+    auto period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / settings.frameRate));
+    auto nextFrame = clock::now();
+    int channel(settings.startChannel), direction(1);
+    std::unique_lock<std::mutex> guard(mutex);
+    while (true) {
+        // paced, and no further ahead of the client than the window
+        changed.wait_until(guard, nextFrame, [this]() { return stopped; });
+        changed.wait(guard, [this]() { return stopped || sent - acked < window; });
+        if (stopped) {
+            break;
+        }
+        ++sent;
+        guard.unlock();
+        sendFrame(channel, settings.stokes);
+        guard.lock();
+        if (!nextChannel(settings, channel, direction)) {
+            done = true;
+            break;
+        }
+        // a frame that took longer than the period (or waited for acks) does not start a burst
+        nextFrame = std::max(nextFrame + period, clock::now());
+    }
+}
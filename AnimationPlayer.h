@@ -0,0 +1,66 @@
+//# AnimationPlayer.h: paces the channel frames of a server-driven animation, with flow control from client acks
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#define ANIMATION_FLOW_WINDOW 4 // frames sent ahead of the client's acks
+#define ANIMATION_MAX_FRAME_RATE 60
+
+namespace carta {
+
+enum class PlaybackMode { ONCE, LOOP, BOUNCE };
+
+struct AnimationSettings {
+    int firstChannel;
+    int lastChannel;  // inclusive
+    int startChannel;
+    int deltaChannel; // negative: backwards
+    int stokes;
+    double frameRate; // frames per second
+    PlaybackMode mode;
+};
+
+class AnimationPlayer {
+public:
+    // called on the player's thread for each frame
+    using FrameCallback = std::function<void(int channel, int stokes)>;
+    using clock = std::chrono::steady_clock;
+
+    AnimationPlayer(const AnimationSettings& settings, FrameCallback sendFrame, int window = ANIMATION_FLOW_WINDOW);
+    ~AnimationPlayer(); // stops and waits for the frame in progress
+    AnimationPlayer(const AnimationPlayer&) = delete;
+    AnimationPlayer& operator=(const AnimationPlayer&) = delete;
+
+    void start();
+    // returns at once; the frame in progress, if any, is finished on the player's thread
+    void requestStop();
+    // client ack of one frame
+    void frameReceived();
+    // a frame passed to the callback that was not sent (failed to load, file closed...): no ack
+    // will come for it, so it does not count against the window
+    void frameSkipped();
+    bool finished(); // played to the end, or stopped
+    int numSent(); // frames passed to the callback, less those skipped
+
+    // the channel after the given one, changing direction when bouncing; false at the end of a ONCE animation
+    static bool nextChannel(const AnimationSettings& settings, int& channel, int& direction);
+
+private:
+    void run();
+
+    AnimationSettings settings;
+    FrameCallback sendFrame;
+    int window;
+    std::mutex mutex;
+    std::condition_variable changed;
+    int sent, acked;
+    bool stopped, done;
+    std::thread worker;
+};
+
+} // namespace carta
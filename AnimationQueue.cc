@@ -1,9 +1,15 @@
 #include "AnimationQueue.h"
+#include "util.h"
+
+#include <unordered_set>
 
 using namespace carta;
 
-AnimationQueue::AnimationQueue(Session *session_)
-    : session(session_)
+AnimationQueue::AnimationQueue(const std::string& uuid_, Handler handler_, size_t skipThreshold_)
+    : uuid(uuid_),
+      handler(std::move(handler_)),
+      skipThreshold(skipThreshold_),
+      dropped(0)
 {}
 
 void AnimationQueue::addRequest(CARTA::SetImageChannels message, uint32_t requestId) {
@@ -12,10 +18,42 @@ void AnimationQueue::addRequest(CARTA::SetImageChannels message, uint32_t reques
 
 bool AnimationQueue::executeOne() {
     std::unique_lock<std::mutex> guard(mutex);
+    // behind real time: jump to the newest channel of each file instead of replaying every frame
+    if (skipThreshold && ready.size() + queue.unsafe_size() > skipThreshold) {
+        dropStale();
+    }
     AnimationQueue::info_t req;
-    if(!queue.try_pop(req)) {
+    if (!ready.empty()) {
+        req = std::move(ready.front());
+        ready.pop_front();
+    } else if (!queue.try_pop(req)) {
         return false;
     }
-    session->onSetImageChannels(req.first, req.second);
+    handler(req.first, req.second);
     return true;
 }
+
+void AnimationQueue::dropStale() {
+    AnimationQueue::info_t req;
+    while (queue.try_pop(req)) {
+        ready.push_back(std::move(req));
+    }
+    std::deque<info_t> newest;
+    std::unordered_set<int> files;
+    for (auto it = ready.rbegin(); it != ready.rend(); ++it) {
+        if (files.insert(it->first.file_id()).second) {
+            newest.push_front(std::move(*it));
+        }
+    }
+    size_t numSkipped = ready.size() - newest.size();
+    ready.swap(newest);
+    if (numSkipped) {
+        dropped += numSkipped;
+        log(uuid, "Animation behind: skipped {} stale channel requests ({} in total)", numSkipped, dropped);
+    }
+}
+
+size_t AnimationQueue::numDropped() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return dropped;
+}
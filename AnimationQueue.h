@@ -2,27 +2,44 @@
 
 #pragma once
 
-#include "Session.h"
 #include <carta-protobuf/set_image_channels.pb.h>
+#include <deque>
+#include <functional>
 #include <mutex>
+#include <string>
 #include <utility>
 #include <tbb/concurrent_queue.h>
 
+#define ANIMATION_SKIP_THRESHOLD 3 // queued channel requests beyond which stale ones are skipped
+
 namespace carta {
 
 class AnimationQueue  {
 public:
-    AnimationQueue(Session *session);
+    // the session's SET_IMAGE_CHANNELS handler
+    using Handler = std::function<void(const CARTA::SetImageChannels& message, uint32_t requestId)>;
+
+    // uuid: of the session, for logging. skipThreshold: 0 to serve every request
+    AnimationQueue(const std::string& uuid, Handler handler, size_t skipThreshold = ANIMATION_SKIP_THRESHOLD);
 
     void addRequest(CARTA::SetImageChannels message, uint32_t requestId);
     bool executeOne();
+    size_t numDropped(); // requests skipped in favour of a newer one for the same file
 
 private:
-    Session *session;
-    std::mutex mutex;
     using info_t = std::pair<CARTA::SetImageChannels,uint32_t>;
     using queue_t = tbb::concurrent_queue<info_t>;
+
+    // keeps only the newest request of each file in ready, in order
+    void dropStale();
+
+    std::string uuid;
+    Handler handler;
+    std::mutex mutex;
     queue_t queue;
+    std::deque<info_t> ready; // taken from the queue, older than anything still in it
+    size_t skipThreshold;
+    size_t dropped;
 };
 
 } // namespace carta
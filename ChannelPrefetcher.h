@@ -0,0 +1,198 @@
+//# ChannelPrefetcher.h: predicts the next channels of an animation from recent requests and reads
+//# them ahead on a background thread
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#define PREFETCH_CHANNELS 3 // channels read ahead of an animation, per file
+#define PREFETCH_HISTORY 3  // consecutive requests with the same stride that start prefetching
+
+namespace carta {
+
+// Data is the channel matrix type: the loader fills it from disk on the prefetch thread
+template <typename Data>
+class ChannelPrefetcher {
+public:
+    using Loader = std::function<void(int channel, int stokes, Data& data)>;
+    using data_ptr = std::shared_ptr<Data>;
+
+    ChannelPrefetcher(Loader loader, int numAhead = PREFETCH_CHANNELS);
+    ~ChannelPrefetcher();
+    ChannelPrefetcher(const ChannelPrefetcher&) = delete;
+    ChannelPrefetcher& operator=(const ChannelPrefetcher&) = delete;
+
+    // Records a channel request (depth: channels in the file) and schedules the channels predicted
+    // to follow it. Returns the requested channel if it was read ahead, waiting if it is being read,
+    // or nullptr if the caller must read it
+    data_ptr take(int channel, int stokes, int depth);
+
+    size_t numHits();
+    size_t numMisses(); // requested during an animation, but not read ahead
+
+private:
+    using key_type = std::pair<int, int>; // channel, stokes
+
+    // channels predicted after the requests so far; empty unless the recent requests have a constant stride
+    std::vector<int> predict(int depth);
+    void run();
+
+    Loader loader;
+    int numAhead;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<int> history; // recent channels of the current stokes
+    int historyStokes;
+    std::deque<key_type> pending;     // predicted, not read yet, nearest first
+    std::map<key_type, data_ptr> ready;
+    key_type reading;                 // being read by the prefetch thread, or (-1, -1)
+    bool stopped;
+    size_t hits, misses;
+    std::thread worker; // started with the first prediction
+};
+
+template <typename Data>
+ChannelPrefetcher<Data>::ChannelPrefetcher(Loader loader_, int numAhead_)
+    : loader(std::move(loader_)),
+      numAhead(numAhead_),
+      historyStokes(-1),
+      reading(-1, -1),
+      stopped(false),
+      hits(0),
+      misses(0) {
+}
+
+template <typename Data>
+ChannelPrefetcher<Data>::~ChannelPrefetcher() {
+    {
+        std::unique_lock<std::mutex> guard(mutex);
+        stopped = true;
+        pending.clear();
+    }
+    changed.notify_all();
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+template <typename Data>
+std::vector<int> ChannelPrefetcher<Data>::predict(int depth) {
+    std::vector<int> channels;
+    if (numAhead <= 0 || depth <= 1 || history.size() < PREFETCH_HISTORY) {
+        return channels;
+    }
+    // stride between requests, modulo depth: playback wraps around the end of the cube
+    auto stride = [depth](int from, int to) {
+        int step = ((to - from) % depth + depth) % depth;
+        return step > depth / 2 ? step - depth : step;
+    };
+    int step = stride(history[history.size() - 2], history.back());
+    if (step == 0) {
+        return channels;
+    }
+    for (size_t i = history.size() - PREFETCH_HISTORY; i + 2 < history.size(); ++i) {
+        if (stride(history[i], history[i + 1]) != step) {
+            return channels;
+        }
+    }
+    int channel = history.back();
+    for (int i = 0; i < numAhead && i < depth - 1; ++i) {
+        channel = ((channel + step) % depth + depth) % depth;
+        channels.push_back(channel);
+    }
+    return channels;
+}
+
+template <typename Data>
+typename ChannelPrefetcher<Data>::data_ptr ChannelPrefetcher<Data>::take(int channel, int stokes, int depth) {
+    std::unique_lock<std::mutex> guard(mutex);
+    if (stokes != historyStokes) {
+        history.clear();
+        historyStokes = stokes;
+    }
+    bool animating = !predict(depth).empty();
+    history.push_back(channel);
+    if (history.size() > PREFETCH_HISTORY) {
+        history.pop_front();
+    }
+
+    // a read in progress is not repeated: disk reads of the file are serialized anyway
+    key_type key(channel, stokes);
+    changed.wait(guard, [&]() { return reading != key; });
+    data_ptr data;
+    auto found = ready.find(key);
+    if (found != ready.end()) {
+        data = std::move(found->second);
+        ready.erase(found);
+        ++hits;
+    } else if (animating) {
+        ++misses;
+    }
+
+    // keep only the channels predicted from this request, nearest first
+    pending.clear();
+    std::map<key_type, data_ptr> predicted;
+    for (auto next : predict(depth)) {
+        key_type nextKey(next, stokes);
+        auto readAhead = ready.find(nextKey);
+        if (readAhead != ready.end()) {
+            predicted[nextKey] = std::move(readAhead->second);
+        } else if (nextKey != reading) {
+            pending.push_back(nextKey);
+        }
+    }
+    ready.swap(predicted);
+    if (!pending.empty() && !worker.joinable()) {
+        worker = std::thread(&ChannelPrefetcher<Data>::run, this);
+    }
+    guard.unlock();
+    changed.notify_all();
+    return data;
+}
+
+template <typename Data>
+void ChannelPrefetcher<Data>::run() {
+    std::unique_lock<std::mutex> guard(mutex);
+    while (true) {
+        changed.wait(guard, [this]() { return stopped || !pending.empty(); });
+        if (stopped) {
+            return;
+        }
+        auto key = pending.front();
+        pending.pop_front();
+        reading = key;
+        guard.unlock();
+        auto data = std::make_shared<Data>();
+        loader(key.first, key.second, *data);
+        guard.lock();
+        // the next request drops it if it is no longer predicted
+        if (ready.size() < static_cast<size_t>(numAhead)) {
+            ready[key] = std::move(data);
+        }
+        reading = key_type(-1, -1);
+        changed.notify_all();
+    }
+}
+
+template <typename Data>
+size_t ChannelPrefetcher<Data>::numHits() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return hits;
+}
+
+template <typename Data>
+size_t ChannelPrefetcher<Data>::numMisses() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return misses;
+}
+
+} // namespace carta
@@ -0,0 +1,226 @@
+#include "CompressionContext.h"
+
+#include <algorithm>
+#include <cmath>
+#include <zlib.h>
+
+using namespace carta;
+
+bool carta::getCompressionMode(const std::string& name, CompressionMode& mode) {
+    for (auto candidate : {CompressionMode::ZFP_PRECISION, CompressionMode::ZFP_RATE, CompressionMode::ZFP_ACCURACY,
+             CompressionMode::LOSSLESS}) {
+        if (name == getCompressionModeName(candidate)) {
+            mode = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* carta::getCompressionModeName(CompressionMode mode) {
+    switch (mode) {
+        case CompressionMode::ZFP_PRECISION:
+            return "precision";
+        case CompressionMode::ZFP_RATE:
+            return "rate";
+        case CompressionMode::ZFP_ACCURACY:
+            return "accuracy";
+        case CompressionMode::LOSSLESS:
+            return "lossless";
+    }
+    return "";
+}
+
+CompressionContext::CompressionContext()
+    : compressedSize(0),
+      stream(nullptr),
+      streamBuffer(nullptr),
+      streamSize(0) {
+    zfp = zfp_stream_open(nullptr);
+    field = zfp_field_alloc();
+    zfp_field_set_type(field, zfp_type_float);
+}
+
+CompressionContext::~CompressionContext() {
+    if (stream) {
+        stream_close(stream);
+    }
+    zfp_field_free(field);
+    zfp_stream_close(zfp);
+}
+
+// Copies a bw x bh block (row stride in pixels) into a 4x4 zfp block with NaNs replaced by the
+// average of its valid pixels, summed in the same order as getNanEncodingsBlock; false if the
+// block has no NaNs or no valid pixels, so it can be encoded from the image as it is
+static bool fillBlock(const float* p, uint32_t stride, uint32_t bw, uint32_t bh, float* block) {
+    int validCount = 0;
+    float sum = 0;
+    for (uint32_t x = 0; x < bw; x++) {
+        for (uint32_t y = 0; y < bh; y++) {
+            float v = p[y * stride + x];
+            if (!std::isnan(v)) {
+                validCount++;
+                sum += v;
+            }
+        }
+    }
+    if (!validCount || validCount == static_cast<int>(bw * bh)) {
+        return false;
+    }
+    float average = sum / validCount;
+    for (uint32_t y = 0; y < bh; y++) {
+        for (uint32_t x = 0; x < bw; x++) {
+            float v = p[y * stride + x];
+            block[4 * y + x] = std::isnan(v) ? average : v;
+        }
+    }
+    return true;
+}
+
+int carta::getNumSubsets(size_t rowLength, size_t numRows, int numThreads) {
+    size_t bySize = std::min(rowLength * numRows / SUBSET_MIN_PIXELS, numRows / SUBSET_MIN_ROWS);
+    return static_cast<int>(std::max<size_t>(1, std::min<size_t>(bySize, std::max(numThreads, 1))));
+}
+
+int CompressionContext::compress(const float* data, uint32_t nx, uint32_t ny, CompressionMode mode, float quality) {
+    if (mode == CompressionMode::LOSSLESS) {
+        return compressLossless(data, static_cast<size_t>(nx) * ny);
+    }
+
+    zfp_field_set_pointer(field, const_cast<float*>(data));
+    zfp_field_set_size_2d(field, nx, ny);
+    if (mode == CompressionMode::ZFP_RATE) {
+        zfp_stream_set_rate(zfp, quality, zfp_type_float, 2, 0);
+    } else if (mode == CompressionMode::ZFP_ACCURACY) {
+        zfp_stream_set_accuracy(zfp, std::ldexp(1.0, -static_cast<int>(std::lround(quality))));
+    } else {
+        zfp_stream_set_precision(zfp, static_cast<uint32_t>(std::lround(quality)));
+    }
+
+    size_t bufsize = zfp_stream_maximum_size(zfp, field);
+    if (buffer.size() < bufsize) {
+        buffer.resize(bufsize);
+    }
+    // the bit stream only needs to be reopened if the buffer moved or grew
+    if (!stream || streamBuffer != buffer.data() || streamSize != buffer.size()) {
+        if (stream) {
+            stream_close(stream);
+        }
+        streamBuffer = buffer.data();
+        streamSize = buffer.size();
+        stream = stream_open(streamBuffer, streamSize);
+        zfp_stream_set_bit_stream(zfp, stream);
+    }
+    zfp_stream_rewind(zfp);
+
+    // One pass over bands of 4 rows: run-lengths of NaNs in raster order, then the band's blocks,
+    // in zfp_compress order, while the band is still in cache. Blocks with NaNs are patched in a
+    // local copy; the image itself is not modified.
+    nanEncodings.clear();
+    size_t runStart = 0;
+    bool inNan = false;
+    float block[16];
+    for (uint32_t y = 0; y < ny; y += 4) {
+        uint32_t bh = std::min(4u, ny - y);
+        const float* band = data + static_cast<size_t>(y) * nx;
+        size_t bandStart = static_cast<size_t>(y) * nx;
+        size_t bandLength = static_cast<size_t>(bh) * nx;
+        bool bandHasNan = false;
+        for (size_t i = 0; i < bandLength; ++i) {
+            bool isNan = std::isnan(band[i]);
+            if (isNan != inNan) {
+                nanEncodings.push_back(static_cast<int32_t>(bandStart + i - runStart));
+                runStart = bandStart + i;
+                inNan = isNan;
+            }
+            bandHasNan |= isNan;
+        }
+
+        for (uint32_t x = 0; x < nx; x += 4) {
+            uint32_t bw = std::min(4u, nx - x);
+            const float* p = band + x;
+            bool full = (bw == 4 && bh == 4);
+            if (bandHasNan && fillBlock(p, nx, bw, bh, block)) {
+                if (full) {
+                    zfp_encode_block_float_2(zfp, block);
+                } else {
+                    zfp_encode_partial_block_strided_float_2(zfp, block, bw, bh, 1, 4);
+                }
+            } else if (full) {
+                zfp_encode_block_strided_float_2(zfp, p, 1, nx);
+            } else {
+                zfp_encode_partial_block_strided_float_2(zfp, p, bw, bh, 1, nx);
+            }
+        }
+    }
+    nanEncodings.push_back(static_cast<int32_t>(static_cast<size_t>(nx) * ny - runStart));
+
+    zfp_stream_flush(zfp);
+    compressedSize = zfp_stream_compressed_size(zfp);
+    return compressedSize ? 0 : 1;
+}
+
+int CompressionContext::compressLossless(const float* data, size_t length) {
+    // byte planes (all first bytes, then all second bytes...): exponent and high mantissa bytes
+    // of neighbouring pixels are similar, which deflate compresses much better than interleaved floats
+    size_t numBytes = length * sizeof(float);
+    if (shuffled.size() < numBytes) {
+        shuffled.resize(numBytes);
+    }
+    const char* bytes = reinterpret_cast<const char*>(data);
+    for (size_t b = 0; b < sizeof(float); ++b) {
+        char* plane = shuffled.data() + b * length;
+        for (size_t i = 0; i < length; ++i) {
+            plane[i] = bytes[i * sizeof(float) + b];
+        }
+    }
+
+    uLongf destLength = compressBound(numBytes);
+    if (buffer.size() < destLength) {
+        buffer.resize(destLength);
+    }
+    nanEncodings.clear();
+    // fastest level: the link, not the ratio, is the bottleneck this mode is for
+    int status = compress2(reinterpret_cast<Bytef*>(buffer.data()), &destLength,
+        reinterpret_cast<const Bytef*>(shuffled.data()), numBytes, Z_BEST_SPEED);
+    compressedSize = (status == Z_OK) ? destLength : 0;
+    return compressedSize ? 0 : 1;
+}
+
+void CompressionContextPool::Releaser::operator()(CompressionContext* context) const {
+    if (context) {
+        pool->release(context);
+    }
+}
+
+CompressionContextPool::CompressionContextPool(size_t reserve) {
+    storage.reserve(reserve);
+    for (size_t i = 0; i < reserve; ++i) {
+        storage.emplace_back(new CompressionContext());
+        idle.push_back(storage.back().get());
+    }
+}
+
+CompressionContextPool::context_ptr CompressionContextPool::acquire() {
+    std::unique_lock<std::mutex> guard(mutex);
+    CompressionContext* context;
+    if (idle.empty()) {
+        // more concurrent subsets or tiles than reserved: grow; stays in the pool afterwards
+        storage.emplace_back(new CompressionContext());
+        context = storage.back().get();
+    } else {
+        context = idle.back();
+        idle.pop_back();
+    }
+    return context_ptr(context, Releaser{this});
+}
+
+void CompressionContextPool::release(CompressionContext* context) {
+    std::unique_lock<std::mutex> guard(mutex);
+    idle.push_back(context);
+}
+
+size_t CompressionContextPool::numContexts() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return storage.size();
+}
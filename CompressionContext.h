@@ -0,0 +1,91 @@
+//# CompressionContext.h: reusable zfp stream, field and buffers for compressing raster data,
+//# handed out by a per-session pool so that each frame reuses warm state instead of allocating
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <zfp.h>
+
+#define COMPRESSION_CONTEXT_RESERVE 8 // contexts pre-allocated per session (one per subset)
+#define SUBSET_MIN_PIXELS 65536       // smaller subsets cost more in task overhead than they gain
+#define SUBSET_MIN_ROWS 4             // one row of zfp blocks
+
+namespace carta {
+
+// How compressed (ZFP) raster data is encoded; the compression quality requested by the client is
+// the parameter of the mode:
+//   ZFP_PRECISION: bits of precision (default)
+//   ZFP_RATE: fixed rate in bits per value, e.g. 8 for 4:1
+//   ZFP_ACCURACY: absolute error tolerance of 2^-quality
+//   LOSSLESS: byte-shuffled float32 + zlib; NaNs are kept, so there are no NaN encodings
+enum class CompressionMode { ZFP_PRECISION, ZFP_RATE, ZFP_ACCURACY, LOSSLESS };
+
+bool getCompressionMode(const std::string& name, CompressionMode& mode);
+const char* getCompressionModeName(CompressionMode mode);
+
+// Number of row bands (subsets) to compress a rowLength x numRows image in parallel: one per
+// worker thread, as long as each band has at least SUBSET_MIN_PIXELS and SUBSET_MIN_ROWS
+int getNumSubsets(size_t rowLength, size_t numRows, int numThreads);
+
+class CompressionContext {
+public:
+    CompressionContext();
+    ~CompressionContext();
+    CompressionContext(const CompressionContext&) = delete;
+    CompressionContext& operator=(const CompressionContext&) = delete;
+
+    // Compresses the nx * ny block at data into buffer, with the run-length encoding of its NaNs
+    // in nanEncodings; NaNs are compressed as the average of the valid pixels in their zfp block.
+    // Same output as getNanEncodingsBlock + compress, in a single pass over the data, which is left
+    // unchanged. The buffer and stream only grow, so repeated frames of the same size do not
+    // allocate. 0 on success.
+    int compress(const float* data, uint32_t nx, uint32_t ny, CompressionMode mode, float quality);
+    int compress(const float* data, uint32_t nx, uint32_t ny, uint32_t precision) {
+        return compress(data, nx, ny, CompressionMode::ZFP_PRECISION, precision);
+    }
+
+    std::vector<char> buffer;           // compressed data: first compressedSize bytes
+    size_t compressedSize;
+    std::vector<int32_t> nanEncodings;
+
+private:
+    int compressLossless(const float* data, size_t length);
+
+    std::vector<char> shuffled; // byte planes for the lossless mode
+    zfp_stream* zfp;
+    zfp_field* field;
+    bitstream* stream; // wraps buffer; reopened when the buffer is reallocated
+    char* streamBuffer;
+    size_t streamSize;
+};
+
+class CompressionContextPool {
+public:
+    // Returns the context to the pool when the handle goes out of scope
+    struct Releaser {
+        CompressionContextPool* pool;
+        void operator()(CompressionContext* context) const;
+    };
+    using context_ptr = std::unique_ptr<CompressionContext, Releaser>;
+
+    CompressionContextPool(size_t reserve = COMPRESSION_CONTEXT_RESERVE);
+    CompressionContextPool(const CompressionContextPool&) = delete;
+    CompressionContextPool& operator=(const CompressionContextPool&) = delete;
+
+    context_ptr acquire();
+    size_t numContexts(); // contexts allocated, in use or idle
+
+private:
+    void release(CompressionContext* context);
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<CompressionContext>> storage; // owns every context
+    std::vector<CompressionContext*> idle;
+};
+
+} // namespace carta
@@ -0,0 +1,69 @@
+#include "EventMessage.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace carta;
+
+void EventMessagePool::Releaser::operator()(EventMessage* message) const {
+    if (message) {
+        pool->release(message);
+    }
+}
+
+EventMessagePool::EventMessagePool(size_t slabSize_, size_t payloadReserve_)
+    : freeList(nullptr),
+      slabSize(slabSize_),
+      payloadReserve(payloadReserve_) {
+    // pre-allocate envelopes so steady-state traffic never touches the allocator
+    storage.reserve(slabSize);
+    for (size_t i = 0; i < slabSize; ++i) {
+        std::unique_ptr<EventMessage> message(new EventMessage());
+        message->payload.reserve(payloadReserve);
+        message->next = freeList;
+        freeList = message.get();
+        storage.push_back(std::move(message));
+    }
+}
+
+void EventMessagePool::release(EventMessage* message) {
+    std::unique_lock<std::mutex> guard(mutex);
+    message->next = freeList;
+    freeList = message;
+}
+
+EventMessagePool::message_ptr EventMessagePool::create(EventType eventType, const char* rawMessage, size_t length,
+    uint64_t sequence) {
+    EventMessage* message;
+    {
+        std::unique_lock<std::mutex> guard(mutex);
+        message = freeList;
+        if (message) {
+            freeList = message->next;
+        } else {
+            // slab exhausted: grow; the new envelope stays in the pool afterwards
+            std::unique_ptr<EventMessage> newMessage(new EventMessage());
+            newMessage->payload.reserve(payloadReserve);
+            message = newMessage.get();
+            storage.push_back(std::move(newMessage));
+        }
+        message->next = nullptr;
+    }
+
+    // only copy of the payload after uWS
+    message->eventType = eventType;
+    message->sequence = sequence;
+    std::memcpy(&message->requestId, rawMessage + EVENT_NAME_LENGTH, sizeof(uint32_t));
+    message->payload.assign(rawMessage + EVENT_HEADER_LENGTH, rawMessage + length);
+    return message_ptr(message, Releaser{this});
+}
+
+size_t EventMessagePool::numPooled() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return storage.size();
+}
+
+size_t EventMessagePool::numAllocated() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return storage.size() - std::min(storage.size(), slabSize);
+}
@@ -0,0 +1,62 @@
+//# EventMessage.h: pooled envelopes for inbound ICD messages, passed from onMessage to OnMessageTask
+//# without copying the payload again after ingress
+
+#pragma once
+
+#include "EventType.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#define MESSAGE_SLAB_SIZE 64         // envelopes pre-allocated per session
+#define MESSAGE_PAYLOAD_RESERVE 1024 // bytes reserved per envelope payload
+#define EVENT_NAME_LENGTH 32         // ICD header: event name (32 bytes) + request id (4 bytes)
+#define EVENT_HEADER_LENGTH 36
+
+namespace carta {
+
+struct EventMessage {
+    EventType eventType;
+    uint32_t requestId;
+    uint64_t sequence; // coalescing stamp for latest-wins events, 0 otherwise
+    std::vector<char> payload;
+
+private:
+    friend class EventMessagePool;
+    EventMessage* next; // intrusive link for the free list
+};
+
+class EventMessagePool {
+public:
+    // Returns the envelope to the pool when the handle goes out of scope
+    struct Releaser {
+        EventMessagePool* pool;
+        void operator()(EventMessage* message) const;
+    };
+    using message_ptr = std::unique_ptr<EventMessage, Releaser>;
+
+    EventMessagePool(size_t slabSize = MESSAGE_SLAB_SIZE, size_t payloadReserve = MESSAGE_PAYLOAD_RESERVE);
+    EventMessagePool(const EventMessagePool&) = delete;
+    EventMessagePool& operator=(const EventMessagePool&) = delete;
+
+    // Fills a pooled envelope from a raw ICD frame (header + payload); the event type (and
+    // coalescing stamp, if any) is resolved from the header by the caller
+    message_ptr create(EventType eventType, const char* rawMessage, size_t length, uint64_t sequence = 0);
+
+    size_t numPooled();
+    size_t numAllocated(); // envelopes allocated beyond the initial slab
+
+private:
+    void release(EventMessage* message);
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<EventMessage>> storage; // owns every envelope
+    EventMessage* freeList;
+    size_t slabSize;
+    size_t payloadReserve;
+};
+
+} // namespace carta
@@ -0,0 +1,67 @@
+#include "EventType.h"
+
+#include <cstring>
+
+using namespace carta;
+
+static const char* eventNames[NUM_EVENT_TYPES + 1] = {
+#define CARTA_EVENT_NAME(name, message, handler, priority, ordering) #name,
+    CARTA_INBOUND_EVENTS(CARTA_EVENT_NAME)
+#undef CARTA_EVENT_NAME
+    "UNKNOWN"
+};
+
+static const EventPriority eventPriorities[NUM_EVENT_TYPES + 1] = {
+#define CARTA_EVENT_PRIORITY(name, message, handler, priority, ordering) priority,
+    CARTA_INBOUND_EVENTS(CARTA_EVENT_PRIORITY)
+#undef CARTA_EVENT_PRIORITY
+    PRIORITY_DEFAULT
+};
+
+static const EventOrdering eventOrderings[NUM_EVENT_TYPES + 1] = {
+#define CARTA_EVENT_ORDERING(name, message, handler, priority, ordering) ordering,
+    CARTA_INBOUND_EVENTS(CARTA_EVENT_ORDERING)
+#undef CARTA_EVENT_ORDERING
+    ANY_ORDER
+};
+
+EventType carta::getEventType(const char* name, size_t maxLength) {
+    // same hash as eventNameHash, bounded by the header field length
+    uint32_t hash = 2166136261u;
+    size_t length = 0;
+    while (length < maxLength && name[length]) {
+        hash = (hash ^ static_cast<uint8_t>(name[length])) * 16777619u;
+        ++length;
+    }
+
+    EventType type;
+    switch (hash) {
+#define CARTA_EVENT_CASE(name, message, handler, priority, ordering) \
+    case eventNameHash(#name):                                     \
+        type = EventType::name;                                    \
+        break;
+        CARTA_INBOUND_EVENTS(CARTA_EVENT_CASE)
+#undef CARTA_EVENT_CASE
+        default:
+            return EventType::UNKNOWN;
+    }
+
+    // reject names that only share a hash with an ICD event
+    const char* expected = eventNames[static_cast<size_t>(type)];
+    if (std::strlen(expected) != length || std::memcmp(expected, name, length)) {
+        return EventType::UNKNOWN;
+    }
+    return type;
+}
+
+const char* carta::getEventName(EventType type) {
+    return eventNames[static_cast<size_t>(type)];
+}
+
+EventPriority carta::getEventPriority(EventType type) {
+    return eventPriorities[static_cast<size_t>(type)];
+}
+
+EventOrdering carta::getEventOrdering(EventType type) {
+    return eventOrderings[static_cast<size_t>(type)];
+}
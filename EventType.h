@@ -0,0 +1,74 @@
+//# EventType.h: ICD event names resolved once at ingress into a compact enum
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Inbound ICD events: X(event name, protobuf message, Session handler, scheduling priority, ordering).
+// New events are added here; the enum, name lookup and dispatch table are generated from this list.
+#define CARTA_INBOUND_EVENTS(X)                                                                                         \
+    X(REGISTER_VIEWER, RegisterViewer, onRegisterViewer, PRIORITY_INTERACTIVE, BARRIER)                                 \
+    X(FILE_LIST_REQUEST, FileListRequest, onFileListRequest, PRIORITY_DEFAULT, ANY_ORDER)                               \
+    X(FILE_INFO_REQUEST, FileInfoRequest, onFileInfoRequest, PRIORITY_DEFAULT, ANY_ORDER)                               \
+    X(OPEN_FILE, OpenFile, onOpenFile, PRIORITY_DEFAULT, BARRIER)                                                       \
+    X(CLOSE_FILE, CloseFile, onCloseFile, PRIORITY_INTERACTIVE, BARRIER)                                                \
+    X(SET_IMAGE_VIEW, SetImageView, onSetImageView, PRIORITY_INTERACTIVE, AFTER_BARRIERS)                               \
+    X(SET_DOWNSAMPLE_FILTER, SetDownsampleFilter, onSetDownsampleFilter, PRIORITY_INTERACTIVE, IN_ORDER)                \
+    X(SET_COMPRESSION_MODE, SetCompressionMode, onSetCompressionMode, PRIORITY_INTERACTIVE, IN_ORDER)                   \
+    X(SET_IMAGE_CHANNELS, SetImageChannels, onSetImageChannels, PRIORITY_INTERACTIVE, IN_ORDER)                         \
+    X(SET_CURSOR, SetCursor, onSetCursor, PRIORITY_INTERACTIVE, AFTER_BARRIERS)                                         \
+    X(SET_SPATIAL_REQUIREMENTS, SetSpatialRequirements, onSetSpatialRequirements, PRIORITY_INTERACTIVE, AFTER_BARRIERS) \
+    X(SET_HISTOGRAM_REQUIREMENTS, SetHistogramRequirements, onSetHistogramRequirements, PRIORITY_DEFAULT, IN_ORDER)     \
+    X(SET_SPECTRAL_REQUIREMENTS, SetSpectralRequirements, onSetSpectralRequirements, PRIORITY_DEFAULT, IN_ORDER)        \
+    X(SET_STATS_REQUIREMENTS, SetStatsRequirements, onSetStatsRequirements, PRIORITY_HEAVY, IN_ORDER)                   \
+    X(SET_REGION, SetRegion, onSetRegion, PRIORITY_DEFAULT, BARRIER)                                                    \
+    X(REMOVE_REGION, RemoveRegion, onRemoveRegion, PRIORITY_INTERACTIVE, BARRIER)                                       \
+    X(START_ANIMATION, StartAnimation, onStartAnimation, PRIORITY_DEFAULT, IN_ORDER)                                    \
+    X(STOP_ANIMATION, StopAnimation, onStopAnimation, PRIORITY_DEFAULT, IN_ORDER)                                       \
+    X(ANIMATION_FLOW_CONTROL, AnimationFlowControl, onAnimationFlowControl, PRIORITY_INTERACTIVE, ANY_ORDER)
+
+namespace carta {
+
+// Task priority on the session thread pool: interactive work (cursor, spatial profiles, raster)
+// preempts heavy work (cube histograms, region stats, region spectral profiles) of other sessions,
+// and of the same session as far as its EventOrdering allows
+enum EventPriority : int {
+    PRIORITY_HEAVY = 0,
+    PRIORITY_DEFAULT = 1,
+    PRIORITY_INTERACTIVE = 2
+};
+
+// Task order within a session. Events that change session state (files, regions, requirements,
+// animations) start in the order they arrived, so priority cannot reorder them. Latest-wins views
+// and cursors only wait for the files and regions they refer to, so the session's queued heavy
+// work does not delay them; independent read-only requests may overtake anything
+enum EventOrdering : int {
+    BARRIER,        // opens or closes files and regions: in order, and AFTER_BARRIERS events wait for it
+    IN_ORDER,
+    AFTER_BARRIERS, // starts after the session's earlier BARRIER events only
+    ANY_ORDER
+};
+
+enum class EventType : uint8_t {
+#define CARTA_EVENT_ENUM(name, message, handler, priority, ordering) name,
+    CARTA_INBOUND_EVENTS(CARTA_EVENT_ENUM)
+#undef CARTA_EVENT_ENUM
+    UNKNOWN
+};
+
+constexpr size_t NUM_EVENT_TYPES = static_cast<size_t>(EventType::UNKNOWN);
+
+// FNV-1a hash of a null-terminated event name; evaluated at compile time for the case labels
+// of the lookup switch, so a collision between two ICD names fails to compile
+constexpr uint32_t eventNameHash(const char* name, uint32_t hash = 2166136261u) {
+    return *name ? eventNameHash(name + 1, (hash ^ static_cast<uint8_t>(*name)) * 16777619u) : hash;
+}
+
+// Resolves the (null-terminated or padded) event name of an ICD header; UNKNOWN if not recognized
+EventType getEventType(const char* name, size_t maxLength);
+const char* getEventName(EventType type);
+EventPriority getEventPriority(EventType type);
+EventOrdering getEventOrdering(EventType type);
+
+} // namespace carta
@@ -1,18 +1,31 @@
 #include "Frame.h"
 #include "util.h"
 
+#include <algorithm>
+#include <chrono>
+#include <limits>
 #include <memory>
 #include <tbb/tbb.h>
 
 using namespace carta;
 using namespace std;
 
-Frame::Frame(const string& uuidString, const string& filename, const string& hdu, int defaultChannel)
+Frame::Frame(const string& uuidString, const string& filename, const string& hdu, int defaultChannel, int prefetchChannels,
+    carta::ChannelPlaneCache* planeCache)
     : uuid(uuidString),
       valid(true),
       filename(filename),
+      hdu(hdu),
       loader(FileLoader::getLoader(filename)),
-      spectralAxis(-1), stokesAxis(-1) {
+      spectralAxis(-1), stokesAxis(-1),
+      filter(carta::DownsampleFilter::MEAN),
+      mipPyramid(std::make_shared<carta::MipPyramid>()),
+      planeCache(planeCache),
+      prefetcher([this](int channel, int stokes, casacore::Matrix<float>& chanMatrix) {
+          if (!getCachedPlane(chanMatrix, channel, stokes)) {
+              loadChannelMatrix(chanMatrix, channel, stokes);
+          }
+      }, prefetchChannels) {
     try {
         if (loader==nullptr) {
             log(uuid, "Problem loading file {}: loader not implemented", filename);
@@ -78,6 +91,9 @@ Frame::Frame(const string& uuidString, const string& filename, const string& hdu
 }
 
 Frame::~Frame() {
+    if (planeCache) {
+        planeCache->eraseFrame(reinterpret_cast<uintptr_t>(this));
+    }
     for (auto& region : regions) {
         region.second.reset();
     }
@@ -88,6 +104,14 @@ bool Frame::isValid() {
     return valid;
 }
 
+std::string Frame::getFileName() {
+    return filename;
+}
+
+std::string Frame::getHdu() {
+    return hdu;
+}
+
 int Frame::getMaxRegionId() {
     int maxRegionId(INT_MIN);
     for (auto it = regions.begin(); it != regions.end(); ++it)
@@ -98,12 +122,15 @@ int Frame::getMaxRegionId() {
 // ********************************************************************
 // Image data
 
-std::vector<float> Frame::getImageData(bool meanFilter) {
+std::vector<float> Frame::getImageData(carta::DownsampleFilter filter) {
+    return getImageData(currentBounds(), currentMip(), filter);
+}
+
+std::vector<float> Frame::getImageData(const CARTA::ImageBounds& bounds, int mip, carta::DownsampleFilter filter) {
     if (!valid) {
         return std::vector<float>();
     }
 
-    CARTA::ImageBounds bounds(currentBounds());
     const int x = bounds.x_min();
     const int y = bounds.y_min();
     const int reqHeight = bounds.y_max() - bounds.y_min();
@@ -118,43 +145,24 @@ std::vector<float> Frame::getImageData(bool meanFilter) {
     vector<float> regionData;
     regionData.resize(numRowsRegion * rowLengthRegion);
 
-    if (meanFilter) {
-        // Perform down-sampling by calculating the mean for each MIPxMIP block
-        auto range = tbb::blocked_range2d<size_t>(0, numRowsRegion, 0, rowLengthRegion);
-        auto loop = [&](const tbb::blocked_range2d<size_t> &r) {
-            for(size_t j = r.rows().begin(); j != r.rows().end(); ++j) {
-                for(size_t i = r.cols().begin(); i != r.cols().end(); ++i) {
-                    float pixelSum = 0;
-                    int pixelCount = 0;
-                    for (auto pixelX = 0; pixelX < mip; pixelX++) {
-                        for (auto pixelY = 0; pixelY < mip; pixelY++) {
-                            auto imageRow = y + j * mip + pixelY;
-                            auto imageCol = x + i * mip + pixelX;
-                            float pixVal = channelCache(imageCol, imageRow);
-                            if (!isnan(pixVal) && !isinf(pixVal)) {
-                                pixelCount++;
-                                pixelSum += pixVal;
-                            }
-                        }
-                    }
-                    regionData[j * rowLengthRegion + i] = pixelCount ? pixelSum / pixelCount : NAN;
-                }
-            }
-        };
-        tbb::parallel_for(range, loop);
+    // the current channel and its pyramid, as the spatial profile takes them: not locked while the
+    // parallel loops below run, which may pick up other tiles of this view
+    casacore::Matrix<float> plane;
+    std::shared_ptr<carta::MipPyramid> pyramid;
+    {
+        std::unique_lock<std::mutex> guard(channelMutex);
+        plane.reference(channelCache);
+        pyramid = mipPyramid;
+    }
+    if (filter == carta::DownsampleFilter::MEAN) {
+        // Perform down-sampling by calculating the mean for each MIPxMIP block, from the nearest
+        // pre-reduced level of the channel
+        pyramid->blockMean(plane.data(), imageShape(0), imageShape(1), x, y, mip,
+            rowLengthRegion, numRowsRegion, regionData.data());
     } else {
-        // Nearest neighbour filtering
-        auto range = tbb::blocked_range2d<size_t>(0, numRowsRegion, 0, rowLengthRegion);
-        auto loop = [&](const tbb::blocked_range2d<size_t> &r) {
-            for (auto j = 0; j < numRowsRegion; j++) {
-                for (auto i = 0; i < rowLengthRegion; i++) {
-                    auto imageRow = y + j * mip;
-                    auto imageCol = x + i * mip;
-                    regionData[j * rowLengthRegion + i] = channelCache(imageCol, imageRow);
-                }
-            }
-        };
-        tbb::parallel_for(range, loop);
+        // nearest neighbour, max, min or median of each MIPxMIP block, directly from the channel
+        carta::downsample(filter, plane.data(), imageShape(0), x, y, mip, rowLengthRegion,
+            numRowsRegion, regionData.data());
     }
     return regionData;
 }
@@ -473,6 +481,18 @@ int Frame::currentMip() {
     return mip;
 }
 
+void Frame::setDownsampleFilter(carta::DownsampleFilter newFilter) {
+    filter = newFilter;
+}
+
+carta::DownsampleFilter Frame::currentDownsampleFilter() {
+    return filter;
+}
+
+casacore::IPosition Frame::getImageShape() {
+    return imageShape;
+}
+
 // ********************************************************************
 // Image channels
 
@@ -498,10 +518,32 @@ bool Frame::setImageChannels(int newChannel, int newStokes, std::string& message
 
     bool channelChanged(newChannel != currentChannel()),
         stokesChanged(newStokes != currentStokes());
-    // update channelCache with new chan and stokes
-    getChannelMatrix(channelCache, newChannel, newStokes);
-    stokesIndex = newStokes;
-    channelIndex = newChannel;
+    // load the new chan and stokes into a back buffer: during an animation, it was read ahead, and
+    // a recently viewed plane is still in memory
+    size_t depth(spectralAxis>=0 ? imageShape(spectralAxis) : 1);
+    auto prefetched = prefetcher.take(newChannel, newStokes, depth);
+    casacore::Matrix<float> plane;
+    if (prefetched) {
+        plane.reference(*prefetched);
+        cachePlane(plane, newChannel, newStokes);
+    } else if (channelChanged || stokesChanged || channelCache.empty()) {
+        if (!getCachedPlane(plane, newChannel, newStokes)) {
+            loadChannelMatrix(plane, newChannel, newStokes);
+            cachePlane(plane, newChannel, newStokes);
+        }
+    }
+    {
+        // swap it in; views and profiles of the old channel finish first
+        std::unique_lock<std::mutex> guard(channelMutex);
+        if (!plane.empty()) {
+            channelCache.reference(plane);
+        }
+        if (channelChanged || stokesChanged) {
+            mipPyramid = std::make_shared<carta::MipPyramid>();
+        }
+        stokesIndex = newStokes;
+        channelIndex = newChannel;
+    }
 
     // update Histogram with current channel
     if (channelChanged) {
@@ -526,18 +568,57 @@ bool Frame::setImageChannels(int newChannel, int newStokes, std::string& message
 
 void Frame::getChannelMatrix(casacore::Matrix<float>& chanMatrix, size_t channel, size_t stokes) {
     // matrix for given channel and stokes
-    if (!channelCache.empty() && channel==channelIndex && stokes==stokesIndex) {
-        // already cached
-        chanMatrix.reference(channelCache);
-        return;
+    {
+        std::unique_lock<std::mutex> guard(channelMutex);
+        if (!channelCache.empty() && channel==channelIndex && stokes==stokesIndex) {
+            // already cached
+            chanMatrix.reference(channelCache);
+            return;
+        }
+    }
+    loadChannelMatrix(chanMatrix, channel, stokes);
+}
+
+bool Frame::getCachedPlane(casacore::Matrix<float>& chanMatrix, size_t channel, size_t stokes) {
+    if (!planeCache) {
+        return false;
+    }
+    auto plane = planeCache->get(reinterpret_cast<uintptr_t>(this), channel, stokes);
+    if (!plane) {
+        return false;
+    }
+    chanMatrix.reference(*plane);
+    return true;
+}
+
+void Frame::cachePlane(const casacore::Matrix<float>& chanMatrix, size_t channel, size_t stokes) {
+    if (planeCache) {
+        // shares the storage of chanMatrix
+        auto plane = std::make_shared<casacore::Matrix<float>>();
+        plane->reference(chanMatrix);
+        planeCache->put(reinterpret_cast<uintptr_t>(this), channel, stokes, plane, chanMatrix.nelements() * sizeof(float));
     }
-    
-    // slice image data
+}
+
+void Frame::loadChannelMatrix(casacore::Matrix<float>& chanMatrix, size_t channel, size_t stokes) {
+    // slice image data in bands of rows, releasing the disk lock between bands: a profile or
+    // histogram read waits for one band, not for the whole channel
     casacore::Slicer section = getChannelMatrixSlicer(channel, stokes);
-    casacore::Array<float> tmp;
-    std::unique_lock<std::mutex> guard(mutex);
-    loader->loadData(FileInfo::Data::XYZW).getSlice(tmp, section, true);
-    chanMatrix.reference(tmp);
+    size_t width(imageShape(0)), height(imageShape(1));
+    size_t bandRows(std::max<size_t>(CHANNEL_LOAD_BAND_PIXELS / width, 1));
+    casacore::Matrix<float> plane(width, height);
+    casacore::IPosition start(section.start()), length(section.length());
+    casacore::Array<float> band;
+    for (size_t y = 0; y < height; y += bandRows) {
+        start(1) = y;
+        length(1) = std::min(bandRows, height - y);
+        {
+            std::unique_lock<std::mutex> guard(mutex);
+            loader->loadData(FileInfo::Data::XYZW).getSlice(band, casacore::Slicer(start, length));
+        }
+        std::copy(band.begin(), band.end(), plane.data() + y * width);
+    }
+    chanMatrix.reference(plane);
 }
 
 casacore::Slicer Frame::getChannelMatrixSlicer(size_t channel, size_t stokes) {
@@ -598,6 +679,14 @@ int Frame::currentStokes() {
     return stokesIndex;
 }
 
+int Frame::numChannels() {
+    return (spectralAxis>=0 ? imageShape(spectralAxis) : 1);
+}
+
+int Frame::numStokes() {
+    return (stokesAxis>=0 ? imageShape(stokesAxis) : 1);
+}
+
 // ********************************************************************
 // Region
 
@@ -816,7 +905,8 @@ bool Frame::setRegionStatsRequirements(int regionId, const std::vector<int> stat
 
 // ***** region data *****
 
-bool Frame::fillRegionHistogramData(int regionId, CARTA::RegionHistogramData* histogramData) {
+bool Frame::fillRegionHistogramData(int regionId, CARTA::RegionHistogramData* histogramData,
+        tbb::task_group_context& context) {
     bool histogramOK(false);
     if (regions.count(regionId)) {
         auto& region = regions[regionId];
@@ -824,6 +914,9 @@ bool Frame::fillRegionHistogramData(int regionId, CARTA::RegionHistogramData* hi
         histogramData->set_stokes(currStokes);
         int defaultNumBins = int(max(sqrt(imageShape(0) * imageShape(1)), 2.0));
         for (int i=0; i<region->numHistogramConfigs(); ++i) {
+            if (context.is_group_execution_cancelled()) {
+                return false;
+            }
             CARTA::SetHistogramRequirements_HistogramConfig config = region->getHistogramConfig(i);
             int configChannel(config.channel()), configNumBins(config.num_bins());
             if (configChannel == -1) configChannel = currentChannel();
@@ -859,7 +952,9 @@ bool Frame::fillRegionHistogramData(int regionId, CARTA::RegionHistogramData* hi
                     histogramArray.reference(chanMatrix);
                 }
                 if (configNumBins < 0) configNumBins = defaultNumBins;
-                region->fillHistogram(newHistogram, histogramArray, configChannel, currStokes, configNumBins);
+                if (!region->fillHistogram(newHistogram, histogramArray, configChannel, currStokes, configNumBins, context)) {
+                    return false;
+                }
             }
         }
         histogramOK = true;
@@ -876,7 +971,15 @@ bool Frame::fillSpatialProfileData(int regionId, CARTA::SpatialProfileData& prof
         int x(ctrlPts[0].x()), y(ctrlPts[0].y());
         profileData.set_x(x);
         profileData.set_y(y);
-        int chan(currentChannel()), stokes(currentStokes());
+        // the current channel, consistent with its indices even if a new channel is swapped in meanwhile
+        casacore::Matrix<float> plane;
+        int chan, stokes;
+        {
+            std::unique_lock<std::mutex> guard(channelMutex);
+            plane.reference(channelCache);
+            chan = channelIndex;
+            stokes = stokesIndex;
+        }
         profileData.set_channel(chan);
         profileData.set_stokes(stokes);
         casacore::uInt imSize(imageShape.size());
@@ -887,7 +990,7 @@ bool Frame::fillSpatialProfileData(int regionId, CARTA::SpatialProfileData& prof
             valuePos(spectralAxis) = chan;
         if (imSize>3 && stokesAxis>=0)
             valuePos(stokesAxis) = stokes;
-        profileData.set_value(channelCache(valuePos));
+        profileData.set_value(plane(valuePos));
         // set profiles
         for (size_t i=0; i<region->numSpatialProfiles(); ++i) {
             // SpatialProfile
@@ -901,12 +1004,12 @@ bool Frame::fillSpatialProfileData(int regionId, CARTA::SpatialProfileData& prof
                 // use stored channel matrix 
                 switch (axisStokes.first) {
                     case 0: { // x
-                        profile = channelCache.column(y).tovector();
+                        profile = plane.column(y).tovector();
                         newProfile->set_end(imageShape(0));
                         break;
                     }
                     case 1: { // y
-                        profile = channelCache.row(x).tovector();
+                        profile = plane.row(x).tovector();
                         newProfile->set_end(imageShape(1));
                         break;
                     }
@@ -938,38 +1041,93 @@ bool Frame::fillSpatialProfileData(int regionId, CARTA::SpatialProfileData& prof
     return profileOK;
 }
 
-bool Frame::fillSpectralProfileData(int regionId, CARTA::SpectralProfileData& profileData) {
+bool Frame::fillSpectralProfileData(int regionId, CARTA::SpectralProfileData& profileData,
+        tbb::task_group_context& context, const ProfileCallback& partialCallback) {
     bool profileOK(false);
     if (regions.count(regionId)) {
         auto& region = regions[regionId];
         // set profile parameters
         int currStokes(currentStokes());
         profileData.set_stokes(currStokes);
-        profileData.set_progress(1.0); // for now (cursor), send all at once
-        // Set channel vals
-        // get slicer
+        profileData.set_progress(0.0);
         std::vector<CARTA::Point> ctrlPts = region->getControlPoints();
         int x(ctrlPts[0].x()), y(ctrlPts[0].y());
-        casacore::Slicer lattSlicer;
-        getProfileSlicer(lattSlicer, x, y, -1, currStokes);
+        size_t nchan(spectralAxis >= 0 ? imageShape(spectralAxis) : 1);
+        size_t nprofiles(region->numSpectralProfiles());
+        // compute in channel chunks if partial profiles are requested; the chunk size adapts
+        // so that each chunk takes about SPECTRAL_CHUNK_TARGET_MS
+        size_t chunkSize(partialCallback ? std::min(nchan, (size_t)SPECTRAL_CHUNK_INITIAL) : nchan);
+        auto tLastUpdate = std::chrono::high_resolution_clock::now();
         // set stats profiles
-        for (size_t i=0; i<region->numSpectralProfiles(); ++i) {
-            // get sublattice for stokes requested in profile
+        for (size_t i=0; i<nprofiles; ++i) {
+            // get slicer for stokes requested in profile
             int profileStokes;
-            if (region->getSpectralConfigStokes(profileStokes, i)) {
-                if (profileStokes != currStokes)
-                    getProfileSlicer(lattSlicer, x, y, -1, profileStokes);
-                casacore::SubLattice<float> subLattice(loader->loadData(FileInfo::Data::XYZW), lattSlicer);
-                std::unique_lock<std::mutex> guard(mutex);
-                region->fillProfileStats(i, profileData, subLattice);
+            if (!region->getSpectralConfigStokes(profileStokes, i)) {
+                continue;
+            }
+            casacore::Slicer lattSlicer;
+            getProfileSlicer(lattSlicer, x, y, -1, profileStokes);
+            int firstProfile(profileData.profiles_size());
+            for (size_t chanStart=0; chanStart<nchan; chanStart+=chunkSize) {
+                if (context.is_group_execution_cancelled()) {
+                    return false;
+                }
+                size_t chanCount(std::min(chunkSize, nchan - chanStart));
+                casacore::IPosition start(lattSlicer.start()), length(lattSlicer.length());
+                if (spectralAxis >= 0) {
+                    start(spectralAxis) = chanStart;
+                    length(spectralAxis) = chanCount;
+                }
+                casacore::SubLattice<float> subLattice(loader->loadData(FileInfo::Data::XYZW),
+                    casacore::Slicer(start, length));
+                CARTA::SpectralProfileData chunkData;
+                auto tStart = std::chrono::high_resolution_clock::now();
+                {
+                    std::unique_lock<std::mutex> guard(mutex);
+                    if (!region->fillProfileStats(i, chunkData, subLattice, context)) {
+                        return false;
+                    }
+                }
+                auto tEnd = std::chrono::high_resolution_clock::now();
+
+                // copy chunk into the full profiles; channels not computed yet are NaN
+                for (int p=0; p<chunkData.profiles_size(); ++p) {
+                    auto& chunkProfile = chunkData.profiles(p);
+                    if (chanStart == 0) {
+                        auto newProfile = profileData.add_profiles();
+                        newProfile->set_coordinate(chunkProfile.coordinate());
+                        newProfile->set_stats_type(chunkProfile.stats_type());
+                        newProfile->mutable_vals()->Resize(nchan, std::numeric_limits<float>::quiet_NaN());
+                    }
+                    auto vals = profileData.mutable_profiles(firstProfile + p)->mutable_vals();
+                    size_t nvals(std::min((size_t)chunkProfile.vals_size(), chanCount));
+                    std::copy_n(chunkProfile.vals().begin(), nvals, vals->begin() + chanStart);
+                }
+
+                float progress((i + float(chanStart + chanCount) / nchan) / nprofiles);
+                profileData.set_progress(progress);
+                if (partialCallback) {
+                    auto dt = std::chrono::duration_cast<std::chrono::microseconds>(tEnd - tStart).count();
+                    if (dt > 0) {
+                        double scale(SPECTRAL_CHUNK_TARGET_MS * 1e3 / dt);
+                        chunkSize = std::max((size_t)1, std::min(nchan, (size_t)(chunkSize * scale)));
+                    }
+                    auto sinceUpdate = std::chrono::duration_cast<std::chrono::milliseconds>(tEnd - tLastUpdate).count();
+                    if ((progress < 1.0) && (sinceUpdate >= SPECTRAL_UPDATE_INTERVAL_MS)) {
+                        partialCallback(profileData);
+                        tLastUpdate = tEnd;
+                    }
+                }
             }
         }
+        profileData.set_progress(1.0);
         profileOK = true;
     }
     return profileOK;
 }
 
-bool Frame::fillRegionStatsData(int regionId, CARTA::RegionStatsData& statsData) {
+bool Frame::fillRegionStatsData(int regionId, CARTA::RegionStatsData& statsData,
+        tbb::task_group_context& context) {
     bool statsOK(false);
     if (regions.count(regionId)) {
         auto& region = regions[regionId];
@@ -980,8 +1138,7 @@ bool Frame::fillRegionStatsData(int regionId, CARTA::RegionStatsData& statsData)
             casacore::Slicer lattSlicer;
             lattSlicer = getChannelMatrixSlicer(currChan, currStokes);  // for entire 2D image, for now
             casacore::SubLattice<float> subLattice(loader->loadData(FileInfo::Data::XYZW), lattSlicer);
-            region->fillStatsData(statsData, subLattice);
-            statsOK = true;
+            statsOK = region->fillStatsData(statsData, subLattice, context);
         }
     }
     return statsOK;
@@ -2,22 +2,37 @@
 //# (profiles, histograms, stats)
 
 #pragma once
+#include <functional>
 #include <vector>
 #include <unordered_map>
 #include <string>
 #include <memory>
 #include <mutex>
 #include <tbb/concurrent_queue.h>
+#include <tbb/task_group.h>
 
 #include <carta-protobuf/region_histogram.pb.h>
 #include <carta-protobuf/spatial_profile.pb.h>
 #include <carta-protobuf/spectral_profile.pb.h>
+#include "ChannelPrefetcher.h"
 #include "ImageData/FileLoader.h"
+#include "MipPyramid.h"
+#include "PlaneCache.h"
+#include "downsampling.h"
 #include "Region/Region.h"
 
 #define IMAGE_REGION_ID -1
 #define CURSOR_REGION_ID 0
 
+#define SPECTRAL_CHUNK_INITIAL 16        // channels in the first chunk of a spectral profile
+#define SPECTRAL_CHUNK_TARGET_MS 50      // chunk size adapts to this compute time
+#define SPECTRAL_UPDATE_INTERVAL_MS 100  // minimum time between partial spectral profiles
+#define CHANNEL_LOAD_BAND_PIXELS 1048576 // pixels read per disk lock when loading a channel
+
+namespace carta {
+using ChannelPlaneCache = PlaneCache<casacore::Matrix<float>>;
+}
+
 struct ChannelStats {
     float minVal;
     float maxVal;
@@ -38,6 +53,7 @@ private:
 
     // image loader, shape, stats from image file
     std::string filename;
+    std::string hdu;
     std::unique_ptr<carta::FileLoader> loader;
     casacore::IPosition imageShape; // (width, height, depth, stokes)
     size_t ndims;
@@ -47,45 +63,72 @@ private:
     // set image view 
     CARTA::ImageBounds bounds;
     int mip;
+    carta::DownsampleFilter filter;
 
     // set image channel
     size_t channelIndex;
     size_t stokesIndex;
 
-    // saved matrix for channelIndex, stokesIndex
+    // saved matrix for channelIndex, stokesIndex. A new channel is loaded into a separate matrix and
+    // swapped in, so readers of the current channel never wait for the disk
     casacore::Matrix<float> channelCache;
+    // mean-reduced levels of channelCache for downsampled views; replaced with the channel, so views
+    // of the old channel keep theirs
+    std::shared_ptr<carta::MipPyramid> mipPyramid;
+    // guards channelCache, mipPyramid and the swap of the channel indices. Readers take references to
+    // them and compute outside it: their parallel loops may run other tasks that need it
+    std::mutex channelMutex;
 
     // Region
     // <region_id, Region>: one Region per ID
     std::unordered_map<int, std::unique_ptr<carta::Region>> regions;
 
+    // recently viewed planes, shared by all frames; nullptr if disabled
+    carta::ChannelPlaneCache* planeCache;
+
+    // channels read ahead during animation; last member, so its thread stops before the loader is deleted
+    carta::ChannelPrefetcher<casacore::Matrix<float>> prefetcher;
+
     bool loadImageChannelStats(bool loadPercentiles = false);
     void setImageRegion(); // set region for entire image
     // fill given matrix for given channel and stokes
     casacore::Slicer getChannelMatrixSlicer(size_t channel, size_t stokes);
     void getChannelMatrix(casacore::Matrix<float>& chanMatrix, size_t channel, size_t stokes);
+    void loadChannelMatrix(casacore::Matrix<float>& chanMatrix, size_t channel, size_t stokes); // from disk
+    bool getCachedPlane(casacore::Matrix<float>& chanMatrix, size_t channel, size_t stokes);
+    void cachePlane(const casacore::Matrix<float>& chanMatrix, size_t channel, size_t stokes);
     // get image data slicer for axis profile: whichever axis is set to -1
     void getProfileSlicer(casacore::Slicer& latticeSlicer, int x, int y, int channel, int stokes);
 
 public:
-    Frame(const std::string& uuidString, const std::string& filename, const std::string& hdu, int defaultChannel = 0);
+    Frame(const std::string& uuidString, const std::string& filename, const std::string& hdu, int defaultChannel = 0,
+        int prefetchChannels = PREFETCH_CHANNELS, carta::ChannelPlaneCache* planeCache = nullptr);
     ~Frame();
 
     bool isValid();
+    std::string getFileName();
+    std::string getHdu();
     int getMaxRegionId();
 
-    // image data
-    std::vector<float> getImageData(bool meanFilter = true);
+    // image data for current view, or for given bounds and mip (e.g. a tile)
+    std::vector<float> getImageData(carta::DownsampleFilter filter = carta::DownsampleFilter::MEAN);
+    std::vector<float> getImageData(const CARTA::ImageBounds& bounds, int mip,
+        carta::DownsampleFilter filter = carta::DownsampleFilter::MEAN);
+    casacore::IPosition getImageShape();
 
     // image view
     bool setBounds(CARTA::ImageBounds imageBounds, int newMip);
     CARTA::ImageBounds currentBounds();
     int currentMip();
+    void setDownsampleFilter(carta::DownsampleFilter newFilter);
+    carta::DownsampleFilter currentDownsampleFilter();
 
     // image channels
     bool setImageChannels(int newChannel, int newStokes, std::string& message);
     int currentStokes();
     int currentChannel();
+    int numChannels();
+    int numStokes();
 
     // region data: pass through to Region
     // SET_REGION fields:
@@ -104,9 +147,16 @@ public:
         const std::vector<CARTA::SetSpectralRequirements_SpectralConfig>& profiles);
     bool setRegionStatsRequirements(int regionId, const std::vector<int> statsTypes);
 
-    // get region histograms, profiles, stats
-    bool fillRegionHistogramData(int regionId, CARTA::RegionHistogramData* histogramData);
+    // get region histograms, profiles, stats; false if the region is missing or the
+    // computation was cancelled through the context
+    bool fillRegionHistogramData(int regionId, CARTA::RegionHistogramData* histogramData,
+        tbb::task_group_context& context);
     bool fillSpatialProfileData(int regionId, CARTA::SpatialProfileData& profileData);
-    bool fillSpectralProfileData(int regionId, CARTA::SpectralProfileData& profileData);
-    bool fillRegionStatsData(int regionId, CARTA::RegionStatsData& statsData);
+    // with a callback, the profile is computed in channel chunks and the callback receives the
+    // partial profile (NaN for channels not yet computed, progress < 1) at most every update interval
+    using ProfileCallback = std::function<void(CARTA::SpectralProfileData& partialData)>;
+    bool fillSpectralProfileData(int regionId, CARTA::SpectralProfileData& profileData,
+        tbb::task_group_context& context, const ProfileCallback& partialCallback = nullptr);
+    bool fillRegionStatsData(int regionId, CARTA::RegionStatsData& statsData,
+        tbb::task_group_context& context);
 };
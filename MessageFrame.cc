@@ -0,0 +1,43 @@
+#include "MessageFrame.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <google/protobuf/io/coded_stream.h>
+
+using google::protobuf::io::CodedOutputStream;
+
+// Tag of a length-delimited field: field number and wire type 2
+static uint32_t bytesFieldTag(int number) {
+    return (static_cast<uint32_t>(number) << 3) | 2;
+}
+
+void carta::writeMessageFrame(std::vector<char>& frame, const std::string& eventName, uint32_t eventId,
+    const google::protobuf::MessageLite& message, const std::vector<BytesField>& fields) {
+    size_t messageLength = message.ByteSize();
+    size_t requiredSize = EVENT_FRAME_HEADER_LENGTH + messageLength;
+    for (auto& field : fields) {
+        requiredSize += CodedOutputStream::VarintSize32(bytesFieldTag(field.number))
+            + CodedOutputStream::VarintSize32(static_cast<uint32_t>(field.size)) + field.size;
+    }
+    frame.resize(requiredSize);
+
+    char* out = frame.data();
+    std::fill_n(out, EVENT_FRAME_HEADER_LENGTH, 0);
+    std::copy_n(eventName.begin(), std::min(eventName.length(), (size_t) EVENT_FRAME_NAME_LENGTH), out);
+    std::memcpy(out + EVENT_FRAME_NAME_LENGTH, &eventId, sizeof(uint32_t));
+    out += EVENT_FRAME_HEADER_LENGTH;
+    message.SerializeWithCachedSizesToArray(reinterpret_cast<uint8_t*>(out));
+    out += messageLength;
+
+    // the only copy of the field data, straight into the frame
+    for (auto& field : fields) {
+        auto* bytes = reinterpret_cast<uint8_t*>(out);
+        bytes = CodedOutputStream::WriteVarint32ToArray(bytesFieldTag(field.number), bytes);
+        bytes = CodedOutputStream::WriteVarint32ToArray(static_cast<uint32_t>(field.size), bytes);
+        if (field.size) {
+            std::memcpy(bytes, field.data, field.size);
+        }
+        out = reinterpret_cast<char*>(bytes) + field.size;
+    }
+}
@@ -0,0 +1,31 @@
+//# MessageFrame.h: writes outgoing ICD messages (header + protobuf) into their final buffer, with
+//# large bytes fields appended from buffers the message does not own
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <google/protobuf/message_lite.h>
+
+#define EVENT_FRAME_NAME_LENGTH 32 // outgoing header: event name (32 bytes) + event id (4 bytes) + padding (4 bytes)
+#define EVENT_FRAME_HEADER_LENGTH 40
+
+namespace carta {
+
+// Element of a repeated bytes field of the message, serialized after the message's own fields.
+// Equivalent to adding it to the message (protobuf merges fields in any order), without copying
+// the data into the message first.
+struct BytesField {
+    int number; // e.g. CARTA::RasterImageData::kImageDataFieldNumber
+    const char* data;
+    size_t size;
+};
+
+// Resizes the frame and writes the header, message and fields into it
+void writeMessageFrame(std::vector<char>& frame, const std::string& eventName, uint32_t eventId,
+    const google::protobuf::MessageLite& message, const std::vector<BytesField>& fields = {});
+
+} // namespace carta
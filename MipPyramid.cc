@@ -0,0 +1,152 @@
+#include "MipPyramid.h"
+#include "downsampling.h"
+
+#include <cmath>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+using namespace carta;
+
+namespace {
+
+// 2x2 reduction of the image
+std::shared_ptr<MipPyramid::Level> reduceImage(const float* image, size_t width, size_t height) {
+    auto level = std::make_shared<MipPyramid::Level>();
+    level->mip = 2;
+    level->width = width / 2;
+    level->height = height / 2;
+    level->mean.resize(level->width * level->height);
+    level->count.resize(level->width * level->height);
+    auto loop = [&](const tbb::blocked_range<size_t>& r) {
+        for (size_t j = r.begin(); j != r.end(); ++j) {
+            blockMeanRow(image + 2 * j * width, width, 2, level->width, &level->mean[j * level->width],
+                &level->count[j * level->width]);
+        }
+    };
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, level->height), loop);
+    return level;
+}
+
+// 2x2 reduction of a level, weighted by count
+std::shared_ptr<MipPyramid::Level> reduceLevel(const MipPyramid::Level& previous) {
+    auto level = std::make_shared<MipPyramid::Level>();
+    level->mip = previous.mip * 2;
+    level->width = previous.width / 2;
+    level->height = previous.height / 2;
+    level->mean.resize(level->width * level->height);
+    level->count.resize(level->width * level->height);
+    auto loop = [&](const tbb::blocked_range<size_t>& r) {
+        for (size_t j = r.begin(); j != r.end(); ++j) {
+            for (size_t i = 0; i < level->width; ++i) {
+                double sum = 0;
+                uint32_t count = 0;
+                for (size_t dy = 0; dy < 2; ++dy) {
+                    size_t index = (2 * j + dy) * previous.width + 2 * i;
+                    for (size_t dx = 0; dx < 2; ++dx) {
+                        uint32_t n = previous.count[index + dx];
+                        if (n) {
+                            sum += double(previous.mean[index + dx]) * n;
+                            count += n;
+                        }
+                    }
+                }
+                level->mean[j * level->width + i] = count ? float(sum / count) : NAN;
+                level->count[j * level->width + i] = count;
+            }
+        }
+    };
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, level->height), loop);
+    return level;
+}
+
+} // namespace
+
+MipPyramid::MipPyramid() : generation(0) {}
+
+void MipPyramid::reset() {
+    std::unique_lock<std::mutex> guard(mutex);
+    levels.clear();
+    ++generation;
+}
+
+MipPyramid::level_ptr MipPyramid::getLevel(const float* image, size_t width, size_t height, int mip) {
+    if (mip < 2) {
+        return nullptr;
+    }
+    size_t index(0);
+    while ((4 << index) <= mip) {
+        ++index;
+    }
+    std::vector<level_ptr> built;
+    uint64_t builtGeneration;
+    {
+        std::unique_lock<std::mutex> guard(mutex);
+        if (index < levels.size()) {
+            return levels[index]->mip == mip ? levels[index] : nullptr;
+        }
+        built = levels;
+        builtGeneration = generation;
+    }
+    // build missing levels up to mip from the largest one available. Threads asking for the same
+    // level at once may each build it; the first one stored is kept
+    while (built.size() <= index) {
+        if (built.empty()) {
+            built.push_back(reduceImage(image, width, height));
+        } else {
+            built.push_back(reduceLevel(*built.back()));
+        }
+    }
+    {
+        std::unique_lock<std::mutex> guard(mutex);
+        if (generation == builtGeneration) {
+            for (size_t k = levels.size(); k < built.size(); ++k) {
+                levels.push_back(built[k]);
+            }
+        }
+    }
+    return built[index]->mip == mip ? built[index] : nullptr;
+}
+
+void MipPyramid::blockMean(const float* image, size_t width, size_t height, int x, int y, int mip,
+    size_t nx, size_t ny, float* output) {
+    // largest pre-reduced level aligned with the requested blocks
+    int levelMip = 1;
+    while ((mip % (levelMip * 2) == 0) && (x % (levelMip * 2) == 0) && (y % (levelMip * 2) == 0)) {
+        levelMip *= 2;
+    }
+    int factor = mip / levelMip;
+
+    if (levelMip == 1) {
+        // from the full resolution image
+        auto loop = [&](const tbb::blocked_range<size_t>& r) {
+            for (size_t j = r.begin(); j != r.end(); ++j) {
+                blockMeanRow(image + (y + j * mip) * width + x, width, mip, nx, output + j * nx);
+            }
+        };
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, ny), loop);
+        return;
+    }
+
+    auto level = getLevel(image, width, height, levelMip);
+    size_t x0 = x / levelMip, y0 = y / levelMip;
+    auto loop = [&](const tbb::blocked_range<size_t>& r) {
+        for (size_t j = r.begin(); j != r.end(); ++j) {
+            for (size_t i = 0; i < nx; ++i) {
+                double sum = 0;
+                uint32_t count = 0;
+                for (int dy = 0; dy < factor; ++dy) {
+                    size_t index = (y0 + j * factor + dy) * level->width + x0 + i * factor;
+                    for (int dx = 0; dx < factor; ++dx) {
+                        uint32_t n = level->count[index + dx];
+                        if (n) {
+                            sum += double(level->mean[index + dx]) * n;
+                            count += n;
+                        }
+                    }
+                }
+                output[j * nx + i] = count ? float(sum / count) : NAN;
+            }
+        }
+    };
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, ny), loop);
+}
@@ -0,0 +1,46 @@
+//# MipPyramid.h: NaN-aware mean-reduced levels (mip 2, 4, 8, ...) of a channel image, built lazily
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace carta {
+
+class MipPyramid {
+public:
+    MipPyramid();
+
+    // Level at mip m: mean and count of finite pixels for each m x m block of the image; blocks
+    // are combined weighted by count so that every level gives the same means as the full image
+    struct Level {
+        int mip;
+        size_t width, height;
+        std::vector<float> mean; // NaN if no finite pixels in block
+        std::vector<uint32_t> count;
+    };
+    using level_ptr = std::shared_ptr<const Level>;
+
+    // Drop all levels, e.g. when the channel changes; levels being built meanwhile are not kept
+    void reset();
+
+    // NaN-aware block mean of the image (width x height, x fastest) over nx * ny output pixels
+    // starting at image pixel (x, y), reduced by mip; served from the largest level that
+    // divides mip and the offsets, building missing levels first
+    void blockMean(const float* image, size_t width, size_t height, int x, int y, int mip,
+        size_t nx, size_t ny, float* output);
+
+    // Builds (if needed) and returns the level for mip, a power of 2 greater than 1. Levels are built
+    // outside the lock: their parallel loops may run tasks (other tiles) that need the pyramid too
+    level_ptr getLevel(const float* image, size_t width, size_t height, int mip);
+
+private:
+    std::mutex mutex;
+    std::vector<level_ptr> levels; // levels[k] has mip 2^(k+1)
+    uint64_t generation; // resets
+};
+
+} // namespace carta
@@ -1,110 +1,79 @@
 #include "OnMessageTask.h"
 #include "util.h"
-#include <algorithm>
+#include <array>
 #include <chrono>
-#include <cstring>
+#include <type_traits>
 #include <fmt/format.h>
 
-// Looks for null termination in a char array to determine event names from message payloads
-std::string getEventName(char* rawMessage) {
-    static const size_t max_len = 32;
-    return std::string(rawMessage, std::min(std::strlen(rawMessage), max_len));
+namespace {
+
+using handler_t = void (*)(Session* session, const carta::EventMessage& msg);
+
+// Latest-wins events (see RequestCoalescer) carry a file id and a coalescing stamp
+template <typename Message>
+struct Coalesced : std::false_type {};
+template <>
+struct Coalesced<CARTA::SetCursor> : std::true_type {};
+template <>
+struct Coalesced<CARTA::SetImageView> : std::true_type {};
+
+template <typename Message>
+bool isCurrent(Session*, const Message&, const carta::EventMessage&, std::false_type) {
+    return true;
+}
+
+template <typename Message>
+bool isCurrent(Session* session, const Message& message, const carta::EventMessage& msg, std::true_type) {
+    auto& coalescer = session->requestCoalescer();
+    if (msg.sequence && !coalescer.isLatest(msg.eventType, message.file_id(), msg.sequence)) {
+        log(session->uuid, "Skipping {} request {}: superseded by request {} ({} skipped)",
+            carta::getEventName(msg.eventType), msg.requestId,
+            coalescer.latestRequestId(msg.eventType, message.file_id()), coalescer.numSuperseded());
+        return false;
+    }
+    return true;
 }
 
-OnMessageTask::OnMessageTask(std::string uuid_, Session *session_,
-                             tbb::concurrent_queue<std::tuple<std::string,uint32_t,std::vector<char>>> *mqueue_,
-                             carta::AnimationQueue *aqueue_)
-    : uuid(uuid_),
-      session(session_),
-      mqueue(mqueue_),
-      aqueue(aqueue_)
+// Parses the payload into the event's protobuf message and forwards it to the Session handler
+template <typename Message, void (Session::*Handler)(const Message&, uint32_t)>
+void dispatch(Session* session, const carta::EventMessage& msg) {
+    Message message;
+    if (message.ParseFromArray(msg.payload.data(), msg.payload.size()) &&
+        isCurrent(session, message, msg, Coalesced<Message>())) {
+        (session->*Handler)(message, msg.requestId);
+    }
+}
+
+// Static dispatch table indexed by carta::EventType
+const std::array<handler_t, carta::NUM_EVENT_TYPES> handlers = {{
+#define CARTA_EVENT_HANDLER(name, message, handler, priority, ordering) &dispatch<CARTA::message, &Session::handler>,
+    CARTA_INBOUND_EVENTS(CARTA_EVENT_HANDLER)
+#undef CARTA_EVENT_HANDLER
+}};
+
+} // namespace
+
+OnMessageTask::OnMessageTask(carta::SessionRegistry::entry_ptr entry_, carta::EventMessagePool::message_ptr msg_)
+    : entry(std::move(entry_)),
+      msg(std::move(msg_))
 {}
 
-tbb::task* OnMessageTask::execute() {
+void OnMessageTask::execute() {
     //CARTA ICD
     auto tStart = std::chrono::high_resolution_clock::now();
-    std::tuple<std::string,uint32_t,std::vector<char>> msg;
-    mqueue->try_pop(msg);
-    std::string eventName;
-    uint32_t requestId;
-    std::vector<char> eventPayload;
-    std::tie(eventName, requestId, eventPayload) = msg;
+    auto& uuid = entry->session->uuid;
+    const char* eventName = carta::getEventName(msg->eventType);
     log(uuid, "Processing operation {}", eventName);
-    if (eventName == "REGISTER_VIEWER") {
-        CARTA::RegisterViewer message;
-        if (message.ParseFromArray(eventPayload.data(), eventPayload.size())) {
-            session->onRegisterViewer(message, requestId);
-        }
-    } else if (eventName == "FILE_LIST_REQUEST") {
-        CARTA::FileListRequest message;
-        if (message.ParseFromArray(eventPayload.data(), eventPayload.size())) {
-            session->onFileListRequest(message, requestId);
-        }
-    } else if (eventName == "FILE_INFO_REQUEST") {
-        CARTA::FileInfoRequest message;
-        if (message.ParseFromArray(eventPayload.data(), eventPayload.size())) {
-            session->onFileInfoRequest(message, requestId);
-        }
-    } else if (eventName == "OPEN_FILE") {
-        CARTA::OpenFile message;
-        if (message.ParseFromArray(eventPayload.data(), eventPayload.size())) {
-            session->onOpenFile(message, requestId);
-        }
-    } else if (eventName == "CLOSE_FILE") {
-        CARTA::CloseFile message;
-        if (message.ParseFromArray(eventPayload.data(), eventPayload.size())) {
-            session->onCloseFile(message, requestId);
-        }
-    } else if (eventName == "SET_IMAGE_VIEW") {
-        CARTA::SetImageView message;
-        if (message.ParseFromArray(eventPayload.data(), eventPayload.size())) {
-            session->onSetImageView(message, requestId);
-        }
-    } else if (eventName == "SET_IMAGE_CHANNELS") {
-        CARTA::SetImageChannels message;
-        if (message.ParseFromArray(eventPayload.data(), eventPayload.size())) {
-            aqueue->executeOne();
-        }
-    } else if (eventName == "SET_CURSOR") {
-        CARTA::SetCursor message;
-        if (message.ParseFromArray(eventPayload.data(), eventPayload.size())) {
-            session->onSetCursor(message, requestId);
-        }
-    } else if (eventName == "SET_SPATIAL_REQUIREMENTS") {
-        CARTA::SetSpatialRequirements message;
-        if (message.ParseFromArray(eventPayload.data(), eventPayload.size())) {
-            session->onSetSpatialRequirements(message, requestId);
-        }
-    } else if (eventName == "SET_HISTOGRAM_REQUIREMENTS") {
-        CARTA::SetHistogramRequirements message;
-        if (message.ParseFromArray(eventPayload.data(), eventPayload.size())) {
-            session->onSetHistogramRequirements(message, requestId);
-        }
-    } else if (eventName == "SET_SPECTRAL_REQUIREMENTS") {
-        CARTA::SetSpectralRequirements message;
-        if (message.ParseFromArray(eventPayload.data(), eventPayload.size())) {
-            session->onSetSpectralRequirements(message, requestId);
-        }
-    } else if (eventName == "SET_STATS_REQUIREMENTS") {
-        CARTA::SetStatsRequirements message;
-        if (message.ParseFromArray(eventPayload.data(), eventPayload.size())) {
-            session->onSetStatsRequirements(message, requestId);
-        }
-    } else if (eventName == "SET_REGION") {
-        CARTA::SetRegion message;
-        if (message.ParseFromArray(eventPayload.data(), eventPayload.size())) {
-            session->onSetRegion(message, requestId);
-        }
-    } else if (eventName == "REMOVE_REGION") {
-        CARTA::RemoveRegion message;
-        if (message.ParseFromArray(eventPayload.data(), eventPayload.size())) {
-            session->onRemoveRegion(message, requestId);
-        }
+    if (msg->eventType == carta::EventType::SET_IMAGE_CHANNELS) {
+        // parsed at ingress; channel requests are served in order from the animation queue
+        entry->animationQueue.executeOne();
+    } else if (msg->eventType != carta::EventType::UNKNOWN) {
+        handlers[static_cast<size_t>(msg->eventType)](entry->session.get(), *msg);
     } else {
-        log(uuid, "Unknown event type {}", eventName);
+        log(uuid, "Unknown event type");
     }
     auto tEnd = std::chrono::high_resolution_clock::now();
     auto dt = std::chrono::duration_cast<std::chrono::microseconds>(tEnd - tStart).count();
     log(uuid, "Operation {} took {}ms", eventName, dt/1e3);
-    return nullptr;
+    // envelope is returned to the session pool when the task is destroyed
 }
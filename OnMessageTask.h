@@ -1,25 +1,21 @@
-//# OnMessageTask.h: dequeues messages and calls appropriate Session handlers
+//# OnMessageTask.h: calls the appropriate Session handler for one inbound message on the thread pool
 
 #pragma once
 
-#include "AnimationQueue.h"
-#include "Session.h"
-#include <tbb/concurrent_queue.h>
-#include <tbb/task.h>
-#include <string>
-#include <tuple>
-#include <vector>
+#include "EventMessage.h"
+#include "SessionRegistry.h"
 
-class OnMessageTask : public tbb::task {
-    std::string uuid;
-    Session *session;
-    tbb::concurrent_queue<std::tuple<std::string,uint32_t,std::vector<char>>> *mqueue;
-    carta::AnimationQueue *aqueue;
-
-    tbb::task* execute();
+// Move-only, and small enough to be queued on the thread pool without allocating
+class OnMessageTask {
+    carta::SessionRegistry::entry_ptr entry; // keeps the session alive until the task has run
+    carta::EventMessagePool::message_ptr msg; // released to the entry's pool first
 
 public:
-    OnMessageTask(std::string uuid_, Session *session_,
-                  tbb::concurrent_queue<std::tuple<std::string,uint32_t,std::vector<char>>> *mq,
-                  carta::AnimationQueue *aq = nullptr);
+    OnMessageTask(carta::SessionRegistry::entry_ptr entry_, carta::EventMessagePool::message_ptr msg_);
+    OnMessageTask(OnMessageTask&&) = default;
+    void execute();
+    // thread pool entry point
+    void operator()(int) {
+        execute();
+    }
 };
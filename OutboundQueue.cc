@@ -0,0 +1,109 @@
+#include "OutboundQueue.h"
+
+using namespace carta;
+
+OutboundQueue::OutboundQueue(size_t maxBytes_)
+    : closed(false),
+      maxBytes(maxBytes_),
+      bytes(0),
+      dropped(0),
+      droppedSize(0) {
+}
+
+void OutboundQueue::drop(std::list<Entry>::iterator it) {
+    ++dropped;
+    droppedSize += it->message.size();
+    bytes -= it->message.size();
+    if (it->policy == DropPolicy::SUPERSEDE) {
+        superseding.erase(it->key);
+    }
+    entries.erase(it);
+}
+
+void OutboundQueue::dropSuperseded(size_t incoming, std::list<Entry>::iterator end) {
+    // stale frames go first, oldest first
+    for (auto it = entries.begin(); bytes + incoming > maxBytes && it != end;) {
+        auto next = std::next(it);
+        if (it->policy == DropPolicy::SUPERSEDE) {
+            drop(it);
+        }
+        it = next;
+    }
+}
+
+size_t OutboundQueue::push(std::vector<char>&& message, DropPolicy policy, uint64_t key) {
+    std::unique_lock<std::mutex> guard(mutex);
+    uint64_t droppedBefore = droppedSize;
+    if (policy == DropPolicy::THROTTLE) {
+        // bulk data is not dropped, so it must not outrun the client: make room, then wait for it
+        dropSuperseded(message.size(), entries.end());
+        popped.wait(guard, [&] { return closed || !bytes || bytes + message.size() <= maxBytes; });
+    }
+    if (closed) {
+        // nobody left to send it to
+        ++dropped;
+        droppedSize += message.size();
+        return droppedSize - droppedBefore;
+    }
+    if (policy == DropPolicy::SUPERSEDE) {
+        auto previous = superseding.find(key);
+        if (previous != superseding.end()) {
+            drop(previous->second);
+        }
+    }
+    bytes += message.size();
+    entries.push_back(Entry{std::move(message), policy, key});
+    auto newest = std::prev(entries.end());
+    if (policy == DropPolicy::SUPERSEDE) {
+        superseding[key] = newest;
+    }
+
+    // over the limit: the new message and KEEP / THROTTLE messages stay
+    dropSuperseded(0, newest);
+    return droppedSize - droppedBefore;
+}
+
+bool OutboundQueue::pop(std::vector<char>& message) {
+    std::unique_lock<std::mutex> guard(mutex);
+    if (entries.empty()) {
+        return false;
+    }
+    auto& entry = entries.front();
+    if (entry.policy == DropPolicy::SUPERSEDE) {
+        superseding.erase(entry.key);
+    }
+    bytes -= entry.message.size();
+    message = std::move(entry.message);
+    entries.pop_front();
+    popped.notify_all();
+    return true;
+}
+
+void OutboundQueue::close() {
+    std::unique_lock<std::mutex> guard(mutex);
+    closed = true;
+    while (!entries.empty()) {
+        drop(entries.begin());
+    }
+    popped.notify_all();
+}
+
+size_t OutboundQueue::size() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return entries.size();
+}
+
+size_t OutboundQueue::queuedBytes() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return bytes;
+}
+
+uint64_t OutboundQueue::numDropped() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return dropped;
+}
+
+uint64_t OutboundQueue::droppedBytes() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return droppedSize;
+}
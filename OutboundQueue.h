@@ -0,0 +1,62 @@
+//# OutboundQueue.h: bounded queue of messages waiting to be sent to a client; superseded
+//# messages are dropped and bulk senders wait instead of piling up behind a slow link
+
+#pragma once
+
+#include <cstddef>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#define OUTBOUND_QUEUE_MAX_BYTES (64 * 1024 * 1024) // per session
+
+namespace carta {
+
+enum class DropPolicy {
+    KEEP,      // never dropped (acks, file info, logs...)
+    SUPERSEDE, // replaced by a newer message with the same key; dropped first when over the limit
+    THROTTLE   // never dropped, but bulk (tiles, animation frames...): the sender waits while over the limit
+};
+
+class OutboundQueue {
+public:
+    OutboundQueue(size_t maxBytes = OUTBOUND_QUEUE_MAX_BYTES);
+
+    // Queues a message. With SUPERSEDE, a queued message with the same key is dropped; then, while
+    // the queue is over its byte limit, the oldest SUPERSEDE messages before this one are dropped.
+    // With THROTTLE, the caller first waits until the message fits, or the queue is empty or closed.
+    // Returns the number of bytes dropped.
+    size_t push(std::vector<char>&& message, DropPolicy policy = DropPolicy::KEEP, uint64_t key = 0);
+    bool pop(std::vector<char>& message);
+    // Drops all queued messages and any pushed later; releases waiting senders
+    void close();
+
+    size_t size();
+    size_t queuedBytes();
+    uint64_t numDropped();
+    uint64_t droppedBytes();
+
+private:
+    struct Entry {
+        std::vector<char> message;
+        DropPolicy policy;
+        uint64_t key;
+    };
+    void drop(std::list<Entry>::iterator it); // mutex held
+    void dropSuperseded(size_t incoming, std::list<Entry>::iterator end); // mutex held
+
+    std::mutex mutex;
+    std::condition_variable popped;
+    bool closed;
+    size_t maxBytes;
+    size_t bytes;
+    uint64_t dropped;
+    uint64_t droppedSize;
+    std::list<Entry> entries; // oldest first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> superseding; // <key, queued SUPERSEDE message>
+};
+
+} // namespace carta
@@ -0,0 +1,192 @@
+//# PlaneCache.h: process-wide LRU cache of decoded (channel, stokes) planes of the open frames, with a
+//# memory budget for all frames and a share of it per frame
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#define PLANE_CACHE_FRAME_SHARE 4 // a frame may use 1/4 of the budget, so one cube cannot evict every other frame
+
+namespace carta {
+
+// Plane is the channel matrix type; the cache only holds references to it
+template <typename Plane>
+class PlaneCache {
+public:
+    using plane_ptr = std::shared_ptr<Plane>;
+
+    PlaneCache(size_t budgetBytes, size_t frameBudgetBytes = 0); // 0: budget / PLANE_CACHE_FRAME_SHARE
+
+    // frame: any id unique among the open frames, e.g. its address. nullptr if not cached
+    plane_ptr get(uintptr_t frame, int channel, int stokes);
+    // stores the plane, evicting the frame's least recently used planes to stay within its share,
+    // then the least recently used planes of any frame to stay within the budget
+    void put(uintptr_t frame, int channel, int stokes, plane_ptr plane, size_t bytes);
+    // when the frame is closed
+    void eraseFrame(uintptr_t frame);
+
+    size_t usedBytes();
+    size_t usedBytes(uintptr_t frame);
+    size_t numPlanes();
+    uint64_t numHits();
+    uint64_t numMisses();
+    uint64_t numEvictions();
+
+private:
+    struct Key {
+        uintptr_t frame;
+        int channel;
+        int stokes;
+        bool operator==(const Key& other) const {
+            return frame == other.frame && channel == other.channel && stokes == other.stokes;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            size_t hash = std::hash<uintptr_t>()(key.frame);
+            return hash ^ ((static_cast<size_t>(key.channel) << 32 | static_cast<uint32_t>(key.stokes))
+                + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2));
+        }
+    };
+    struct Entry {
+        Key key;
+        plane_ptr plane;
+        size_t bytes;
+    };
+    using iterator = typename std::list<Entry>::iterator;
+
+    void erase(iterator it);
+
+    std::mutex mutex;
+    size_t budget;
+    size_t frameBudget;
+    size_t used;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    std::list<Entry> entries; // most recently used first
+    std::unordered_map<Key, iterator, KeyHash> index;
+    std::unordered_map<uintptr_t, size_t> frameUsed;
+};
+
+template <typename Plane>
+PlaneCache<Plane>::PlaneCache(size_t budgetBytes, size_t frameBudgetBytes)
+    : budget(budgetBytes),
+      frameBudget(frameBudgetBytes ? frameBudgetBytes : budgetBytes / PLANE_CACHE_FRAME_SHARE),
+      used(0),
+      hits(0),
+      misses(0),
+      evictions(0) {
+}
+
+template <typename Plane>
+void PlaneCache<Plane>::erase(iterator it) {
+    used -= it->bytes;
+    auto frameBytes = frameUsed.find(it->key.frame);
+    frameBytes->second -= it->bytes;
+    if (!frameBytes->second) {
+        frameUsed.erase(frameBytes);
+    }
+    index.erase(it->key);
+    entries.erase(it);
+}
+
+template <typename Plane>
+typename PlaneCache<Plane>::plane_ptr PlaneCache<Plane>::get(uintptr_t frame, int channel, int stokes) {
+    std::unique_lock<std::mutex> guard(mutex);
+    auto it = index.find(Key{frame, channel, stokes});
+    if (it == index.end()) {
+        ++misses;
+        return nullptr;
+    }
+    ++hits;
+    entries.splice(entries.begin(), entries, it->second);
+    return it->second->plane;
+}
+
+template <typename Plane>
+void PlaneCache<Plane>::put(uintptr_t frame, int channel, int stokes, plane_ptr plane, size_t bytes) {
+    if (!plane || bytes > frameBudget || bytes > budget) {
+        return;
+    }
+    std::unique_lock<std::mutex> guard(mutex);
+    Key key{frame, channel, stokes};
+    auto it = index.find(key);
+    if (it != index.end()) {
+        erase(it->second);
+    }
+    entries.push_front(Entry{key, plane, bytes});
+    index[key] = entries.begin();
+    used += bytes;
+    size_t& frameBytes = frameUsed[frame];
+    frameBytes += bytes;
+    // the frame's least recently used planes; the new plane fits in the share, so it stays
+    for (auto it = entries.end(); frameBytes > frameBudget;) {
+        --it;
+        if (it->key.frame == frame) {
+            auto victim = it++;
+            erase(victim);
+            ++evictions;
+        }
+    }
+    while (used > budget) {
+        erase(std::prev(entries.end()));
+        ++evictions;
+    }
+}
+
+template <typename Plane>
+void PlaneCache<Plane>::eraseFrame(uintptr_t frame) {
+    std::unique_lock<std::mutex> guard(mutex);
+    for (auto it = entries.begin(); it != entries.end();) {
+        auto next = std::next(it);
+        if (it->key.frame == frame) {
+            erase(it);
+        }
+        it = next;
+    }
+}
+
+template <typename Plane>
+size_t PlaneCache<Plane>::usedBytes() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return used;
+}
+
+template <typename Plane>
+size_t PlaneCache<Plane>::usedBytes(uintptr_t frame) {
+    std::unique_lock<std::mutex> guard(mutex);
+    auto frameBytes = frameUsed.find(frame);
+    return frameBytes == frameUsed.end() ? 0 : frameBytes->second;
+}
+
+template <typename Plane>
+size_t PlaneCache<Plane>::numPlanes() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return entries.size();
+}
+
+template <typename Plane>
+uint64_t PlaneCache<Plane>::numHits() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return hits;
+}
+
+template <typename Plane>
+uint64_t PlaneCache<Plane>::numMisses() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return misses;
+}
+
+template <typename Plane>
+uint64_t PlaneCache<Plane>::numEvictions() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return evictions;
+}
+
+} // namespace carta
@@ -47,9 +47,9 @@ size_t Region::numHistogramConfigs() {
     return m_stats->numHistogramConfigs();
 }
 
-void Region::fillHistogram(CARTA::Histogram* histogram, const casacore::Array<float>& histogramArray,
-        const size_t chanIndex, const size_t stokesIndex, const int numBins) {
-    return m_stats->fillHistogram(histogram, histogramArray, chanIndex, stokesIndex, numBins);
+bool Region::fillHistogram(CARTA::Histogram* histogram, const casacore::Array<float>& histogramArray,
+        const size_t chanIndex, const size_t stokesIndex, const int numBins, tbb::task_group_context& context) {
+    return m_stats->fillHistogram(histogram, histogramArray, chanIndex, stokesIndex, numBins, context);
 }
 
 // stats
@@ -61,8 +61,9 @@ size_t Region::numStats() {
     return m_stats->numStats();
 }
 
-void Region::fillStatsData(CARTA::RegionStatsData& statsData, const casacore::SubLattice<float>& subLattice) {
-    m_stats->fillStatsData(statsData, subLattice);
+bool Region::fillStatsData(CARTA::RegionStatsData& statsData, const casacore::SubLattice<float>& subLattice,
+        tbb::task_group_context& context) {
+    return m_stats->fillStatsData(statsData, subLattice, context);
 }
 
 // ***********************************
@@ -102,8 +103,8 @@ bool Region::getSpectralConfigStokes(int& stokes, int profileIndex) {
     return m_profiler->getSpectralConfigStokes(stokes, profileIndex);
 }
 
-void Region::fillProfileStats(int profileIndex, CARTA::SpectralProfileData& profileData,
-    casacore::SubLattice<float>& lattice) {
+bool Region::fillProfileStats(int profileIndex, CARTA::SpectralProfileData& profileData,
+    casacore::SubLattice<float>& lattice, tbb::task_group_context& context) {
     // Fill SpectralProfileData with statistics values according to config stored in RegionProfiler;
     // RegionStats does calculations
     CARTA::SetSpectralRequirements_SpectralConfig config;
@@ -127,18 +128,20 @@ void Region::fillProfileStats(int profileIndex, CARTA::SpectralProfileData& prof
             const std::vector<int> requestedStats(config.stats_types().begin(), config.stats_types().end());
             size_t nstats = requestedStats.size();
             std::vector<std::vector<float>> statsValues; // a float vector for each stats type
-            if (m_stats->getStatsValues(statsValues, requestedStats, lattice)) {
-                for (size_t i=0; i<nstats; ++i) {
-                    // one SpectralProfile per stats type
-                    auto newProfile = profileData.add_profiles();
-                    newProfile->set_coordinate(coordinate);
-                    auto statType = static_cast<CARTA::StatsType>(requestedStats[i]);
-                    newProfile->set_stats_type(statType);
-                    std::vector<float> svalues(statsValues[i]);
-                    *newProfile->mutable_vals() = {svalues.begin(), svalues.end()};
-                }
+            if (!m_stats->getStatsValues(statsValues, requestedStats, lattice, context, /*perChannel*/ true)) {
+                return false; // cancelled
+            }
+            for (size_t i=0; i<nstats; ++i) {
+                // one SpectralProfile per stats type
+                auto newProfile = profileData.add_profiles();
+                newProfile->set_coordinate(coordinate);
+                auto statType = static_cast<CARTA::StatsType>(requestedStats[i]);
+                newProfile->set_stats_type(statType);
+                std::vector<float> svalues(statsValues[i]);
+                *newProfile->mutable_vals() = {svalues.begin(), svalues.end()};
             }
         }
     }
+    return true;
 }
 
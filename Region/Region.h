@@ -29,8 +29,8 @@ public:
     bool setHistogramRequirements(const std::vector<CARTA::SetHistogramRequirements_HistogramConfig>& histogramReqs);
     CARTA::SetHistogramRequirements_HistogramConfig getHistogramConfig(int histogramIndex);
     size_t numHistogramConfigs();
-    void fillHistogram(CARTA::Histogram* histogram, const casacore::Array<float>& histogramArray,
-        const size_t chanIndex, const size_t stokesIndex, const int numBins);
+    bool fillHistogram(CARTA::Histogram* histogram, const casacore::Array<float>& histogramArray,
+        const size_t chanIndex, const size_t stokesIndex, const int numBins, tbb::task_group_context& context);
 
     // Spatial: pass through to RegionProfiler
     bool setSpatialRequirements(const std::vector<std::string>& profiles,
@@ -45,13 +45,14 @@ public:
     size_t numSpectralProfiles();
     bool getSpectralConfigStokes(int& stokes, int profileIndex);
     bool getSpectralConfig(CARTA::SetSpectralRequirements_SpectralConfig& config, int profileIndex);
-    void fillProfileStats(int profileIndex, CARTA::SpectralProfileData& profileData, 
-        casacore::SubLattice<float>& lattice);
+    bool fillProfileStats(int profileIndex, CARTA::SpectralProfileData& profileData,
+        casacore::SubLattice<float>& lattice, tbb::task_group_context& context);
 
     // Stats: pass through to RegionStats
     void setStatsRequirements(const std::vector<int>& statsTypes);
     size_t numStats();
-    void fillStatsData(CARTA::RegionStatsData& statsData, const casacore::SubLattice<float>& subLattice);
+    bool fillStatsData(CARTA::RegionStatsData& statsData, const casacore::SubLattice<float>& subLattice,
+        tbb::task_group_context& context);
 
 private:
 
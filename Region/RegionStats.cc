@@ -36,8 +36,8 @@ CARTA::SetHistogramRequirements_HistogramConfig RegionStats::getHistogramConfig(
     return config;
 }
 
-void RegionStats::fillHistogram(CARTA::Histogram* histogram, const casacore::Array<float>& histogramArray,
-        const size_t chanIndex, const size_t stokesIndex, const int nBins) {
+bool RegionStats::fillHistogram(CARTA::Histogram* histogram, const casacore::Array<float>& histogramArray,
+        const size_t chanIndex, const size_t stokesIndex, const int nBins, tbb::task_group_context& context) {
     // stored?
     if (m_channelHistograms.count(chanIndex) && m_stokes==stokesIndex && m_bins==nBins) {
         *histogram = m_channelHistograms[chanIndex];
@@ -50,11 +50,14 @@ void RegionStats::fillHistogram(CARTA::Histogram* histogram, const casacore::Arr
         if (is2D) {
             // (row_begin, row_end, col_begin, col_end)
             tbb::blocked_range2d<size_t> range(0, inputShape(1), 0, inputShape(0));
-            tbb::parallel_reduce(range, mm);
+            tbb::parallel_reduce(range, mm, context);
         } else {  // cube histogram
             // (page_begin, page_end, row_begin, row_end, col_begin, col_end)
             tbb::blocked_range3d<size_t> range(0, inputShape(2), 0, inputShape(1), 0, inputShape(0));
-            tbb::parallel_reduce(range, mm);
+            tbb::parallel_reduce(range, mm, context);
+        }
+        if (context.is_group_execution_cancelled()) {
+            return false;
         }
         float minVal, maxVal;
         std::tie(minVal, maxVal) = mm.getMinMax();
@@ -63,10 +66,13 @@ void RegionStats::fillHistogram(CARTA::Histogram* histogram, const casacore::Arr
         Histogram hist(nBins, minVal, maxVal, histogramArray);
         if (is2D) {
             tbb::blocked_range2d<size_t> range(0, inputShape(1), 0, inputShape(0));
-            tbb::parallel_reduce(range, hist);
+            tbb::parallel_reduce(range, hist, context);
         } else {  // cube histogram
             tbb::blocked_range3d<size_t, size_t, size_t> range(0, inputShape(2), 0, inputShape(1), 0, inputShape(0));
-            tbb::parallel_reduce(range, hist);
+            tbb::parallel_reduce(range, hist, context);
+        }
+        if (context.is_group_execution_cancelled()) {
+            return false;
         }
         std::vector<int> histogramBins = hist.getHistogram();
         float binWidth = hist.getBinWidth();
@@ -86,6 +92,7 @@ void RegionStats::fillHistogram(CARTA::Histogram* histogram, const casacore::Arr
         m_stokes = stokesIndex;
         m_bins = nBins;
     }
+    return true;
 }
 
 // ***** Statistics *****
@@ -98,38 +105,49 @@ size_t RegionStats::numStats() {
    return m_regionStats.size();
 }
 
-void RegionStats::fillStatsData(CARTA::RegionStatsData& statsData, const casacore::SubLattice<float>& subLattice) {
+bool RegionStats::fillStatsData(CARTA::RegionStatsData& statsData, const casacore::SubLattice<float>& subLattice,
+        tbb::task_group_context& context) {
     // fill RegionStatsData with statistics types set in requirements
 
     if (m_regionStats.empty()) {  // no requirements set
         // add empty StatisticsValue
         auto statsValue = statsData.add_statistics();  // pointer
         statsValue->set_stats_type(CARTA::StatsType::None);
-        return;
+        return true;
     }
 
     std::vector<std::vector<float>> results;
-    if (getStatsValues(results, m_regionStats, subLattice)) {
-        for (size_t i=0; i<m_regionStats.size(); ++i) {
-            auto statType = static_cast<CARTA::StatsType>(m_regionStats[i]);
-            std::vector<float> values(results[i]);
-            // add StatisticsValue
-            auto statsValue = statsData.add_statistics();
-            statsValue->set_stats_type(statType);
-            statsValue->set_value(values[0]); // only one value allowed
-        }
+    if (!getStatsValues(results, m_regionStats, subLattice, context)) {
+        return false;
     }
+    for (size_t i=0; i<m_regionStats.size(); ++i) {
+        auto statType = static_cast<CARTA::StatsType>(m_regionStats[i]);
+        std::vector<float> values(results[i]);
+        // add StatisticsValue
+        auto statsValue = statsData.add_statistics();
+        statsValue->set_stats_type(statType);
+        statsValue->set_value(values[0]); // only one value allowed
+    }
+    return true;
 }
 
 bool RegionStats::getStatsValues(std::vector<std::vector<float>>& statsValues,
-    const std::vector<int>& requestedStats, const casacore::SubLattice<float>& subLattice) {
+    const std::vector<int>& requestedStats, const casacore::SubLattice<float>& subLattice,
+    tbb::task_group_context& context, bool perChannel) {
     // Fill statsValues vector for requested stats; one vector<float> per stat
 
     // use LatticeStatistics to fill statistics values according to type
     casacore::LatticeStatistics<float> latticeStats = casacore::LatticeStatistics<float>(subLattice,
             /*showProgress*/ false, /*forceDisk*/ false, /*clone*/ false);
+    if (perChannel) {
+        latticeStats.setAxes(casacore::IPosition(2, 0, 1)); // cursor axes x, y
+    }
 
     for (size_t i=0; i<requestedStats.size(); ++i) {
+        // LatticeStatistics cannot be interrupted; stop between statistics
+        if (context.is_group_execution_cancelled()) {
+            return false;
+        }
         // get requested statistics values
         std::vector<float> values;
         casacore::LatticeStatsBase::StatisticsTypes lattStatsType(casacore::LatticeStatsBase::NSTATS);
@@ -10,6 +10,8 @@
 #include <casacore/casa/Arrays/IPosition.h>
 #include <casacore/lattices/Lattices/SubLattice.h>
 
+#include <tbb/task_group.h>
+
 #include <vector>
 #include <unordered_map>
 
@@ -22,15 +24,20 @@ public:
     bool setHistogramRequirements(const std::vector<CARTA::SetHistogramRequirements_HistogramConfig>& histogramReqs);
     size_t numHistogramConfigs();
     CARTA::SetHistogramRequirements_HistogramConfig getHistogramConfig(int histogramIndex);
-    void fillHistogram(CARTA::Histogram* histogram, const casacore::Array<float>& histogramArray,
-        const size_t chanIndex, const size_t stokesIndex, const int nBins);
+    // false if cancelled through the context; cancelled histograms are not stored
+    bool fillHistogram(CARTA::Histogram* histogram, const casacore::Array<float>& histogramArray,
+        const size_t chanIndex, const size_t stokesIndex, const int nBins, tbb::task_group_context& context);
 
     // Stats
     void setStatsRequirements(const std::vector<int>& statsTypes);
     size_t numStats();
-    void fillStatsData(CARTA::RegionStatsData& statsData, const casacore::SubLattice<float>& subLattice);
+    bool fillStatsData(CARTA::RegionStatsData& statsData, const casacore::SubLattice<float>& subLattice,
+        tbb::task_group_context& context);
+    // false if cancelled through the context, checked before each statistic;
+    // perChannel computes each statistic over the xy-plane for every channel (spectral profiles)
     bool getStatsValues(std::vector<std::vector<float>>& statsValues,
-        const std::vector<int>& requestedStats, const casacore::SubLattice<float>& lattice);
+        const std::vector<int>& requestedStats, const casacore::SubLattice<float>& lattice,
+        tbb::task_group_context& context, bool perChannel = false);
 
 private:
     // Histograms
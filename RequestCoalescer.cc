@@ -0,0 +1,86 @@
+#include "RequestCoalescer.h"
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+
+using namespace carta;
+
+RequestCoalescer::RequestCoalescer()
+    : sequence(0),
+      superseded(0)
+{}
+
+uint64_t RequestCoalescer::key(EventType type, int fileId) {
+    return (static_cast<uint64_t>(type) << 32) | static_cast<uint32_t>(fileId);
+}
+
+uint64_t RequestCoalescer::stamp(EventType type, int fileId, uint32_t requestId) {
+    std::unique_lock<std::mutex> guard(mutex);
+    auto& entry = latest[key(type, fileId)];
+    entry.sequence = ++sequence;
+    entry.requestId = requestId;
+    return entry.sequence;
+}
+
+bool RequestCoalescer::isLatest(EventType type, int fileId, uint64_t requestSequence) {
+    std::unique_lock<std::mutex> guard(mutex);
+    auto it = latest.find(key(type, fileId));
+    if (it != latest.end() && it->second.sequence > requestSequence) {
+        ++superseded;
+        return false;
+    }
+    return true;
+}
+
+uint32_t RequestCoalescer::latestRequestId(EventType type, int fileId) {
+    std::unique_lock<std::mutex> guard(mutex);
+    auto it = latest.find(key(type, fileId));
+    return (it != latest.end() ? it->second.requestId : 0);
+}
+
+uint64_t RequestCoalescer::numSuperseded() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return superseded;
+}
+
+bool RequestCoalescer::readFileId(const char* payload, size_t length, int32_t& fileId) {
+    using google::protobuf::internal::WireFormatLite;
+    google::protobuf::io::CodedInputStream input(reinterpret_cast<const uint8_t*>(payload), static_cast<int>(length));
+    int32_t value(0);
+    uint32_t tag;
+    while ((tag = input.ReadTag()) != 0) {
+        if (WireFormatLite::GetTagFieldNumber(tag) != 1) {
+            if (!WireFormatLite::SkipField(&input, tag)) {
+                return false;
+            }
+            continue;
+        }
+        // sfixed32 in the ICD; a varint encoding is accepted too. The last one wins, as when parsing
+        switch (WireFormatLite::GetTagWireType(tag)) {
+            case WireFormatLite::WIRETYPE_FIXED32: {
+                uint32_t fixed;
+                if (!input.ReadLittleEndian32(&fixed)) {
+                    return false;
+                }
+                value = static_cast<int32_t>(fixed);
+                break;
+            }
+            case WireFormatLite::WIRETYPE_VARINT: {
+                uint64_t varint;
+                if (!input.ReadVarint64(&varint)) {
+                    return false;
+                }
+                value = static_cast<int32_t>(varint);
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    // a zero tag before the end of the payload is invalid
+    if (!input.ConsumedEntireMessage()) {
+        return false;
+    }
+    fileId = value;
+    return true;
+}
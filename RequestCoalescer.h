@@ -0,0 +1,44 @@
+//# RequestCoalescer.h: latest-wins coalescing of cursor and view requests per file
+
+#pragma once
+
+#include "EventType.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+namespace carta {
+
+class RequestCoalescer {
+public:
+    RequestCoalescer();
+
+    // Called at ingress: records the request as the newest for (type, fileId) and returns its
+    // sequence number. A request still pending for the same key is superseded.
+    uint64_t stamp(EventType type, int fileId, uint32_t requestId);
+    // Called by the task before processing: false if a newer request for (type, fileId) arrived
+    bool isLatest(EventType type, int fileId, uint64_t sequence);
+    uint32_t latestRequestId(EventType type, int fileId);
+    // Number of requests skipped because they were superseded
+    uint64_t numSuperseded();
+
+    // Reads the file id (field 1) of a SET_CURSOR or SET_IMAGE_VIEW payload for stamp(), without
+    // parsing the rest of the message; 0 if absent, as for a parsed message. False if malformed
+    static bool readFileId(const char* payload, size_t length, int32_t& fileId);
+
+private:
+    struct Entry {
+        uint64_t sequence;
+        uint32_t requestId;
+    };
+    static uint64_t key(EventType type, int fileId);
+
+    std::mutex mutex;
+    uint64_t sequence;
+    uint64_t superseded;
+    std::unordered_map<uint64_t, Entry> latest;
+};
+
+} // namespace carta
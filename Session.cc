@@ -9,26 +9,67 @@
 
 #include <tbb/tbb.h>
 
+#include <atomic>
+#include <memory>
+
 using namespace std;
 using namespace CARTA;
 
 // Default constructor. Associates a websocket with a UUID and sets the base folder for all files
-Session::Session(uWS::WebSocket<uWS::SERVER>* ws, std::string uuid, unordered_map<string, vector<string>>& permissionsMap, bool enforcePermissions, string folder, uS::Async *outgoing, bool verbose)
+Session::Session(uWS::WebSocket<uWS::SERVER>* ws, std::string uuid, unordered_map<string, vector<string>>& permissionsMap, bool enforcePermissions, string folder, uS::Async *outgoing, bool verbose, bool tiles, carta::TileCache* cache, carta::DownsampleFilter filter, carta::CompressionMode compressionMode, bool adaptive, int prefetch, carta::ChannelPlaneCache* planes, TaskPoster postTask)
     : uuid(std::move(uuid)),
       socket(ws),
       permissionsMap(permissionsMap),
       permissionsEnabled(enforcePermissions),
       baseFolder(folder),
       verboseLogging(verbose),
-      outgoing(outgoing) {
+      outgoing(outgoing),
+      adaptive(adaptive),
+      sentBytes(0),
+      sending(false),
+      refineFileId(-1),
+      refineRequestId(0),
+      tiledRaster(tiles),
+      tileCache(cache),
+      planeCache(planes),
+      downsampleFilter(filter),
+      prefetchChannels(prefetch),
+      animationNumber(0),
+      postTask(std::move(postTask)) {
+    // a stock client decodes compression_type ZFP as precision mode
+    compressionSettings.mode = carta::CompressionMode::ZFP_PRECISION;
+    serverCompressionMode = compressionMode;
 }
 
+// May run on a task thread, after the last task holding the session; the event loop
+// handles were closed by disconnect
 Session::~Session() {
+    // animation threads call into the session
+    stopAnimation(-1);
+    taskContexts.cancelAll();
     for (auto& frame : frames) {
         frame.second.reset();
     }
     frames.clear();
-    outgoing->close();
+}
+
+void Session::disconnect() {
+    taskContexts.cancelAll();
+    {
+        // joined when the session is deleted; not on the event loop
+        std::unique_lock<std::mutex> guard(animationMutex);
+        for (auto& animation : animations) {
+            animation.second.second->requestStop();
+        }
+    }
+    // releases tasks waiting to queue bulk data
+    out_msgs.close();
+    std::unique_lock<std::mutex> guard(outgoingMutex);
+    if (outgoing) {
+        outgoing->close();
+        outgoing = nullptr;
+    }
+    socket = nullptr;
 }
 
 bool Session::checkPermissionForEntry(string entry) {
@@ -175,14 +216,29 @@ bool Session::fillExtendedFileInfo(FileInfoExtended* extendedInfo, FileInfo* fil
 // ********************************************************************************
 // Histogram message; sent separately or within RasterImageData
 
-CARTA::RegionHistogramData* Session::getRegionHistogramData(const int32_t fileId, const int32_t regionId) {
+CARTA::RegionHistogramData* Session::getRegionHistogramData(const int32_t fileId, const int32_t regionId,
+    bool* cancelled) {
     RegionHistogramData* histogramMessage(nullptr);
+    bool histogramCancelled(false);
     if (frames.count(fileId)) {
         auto& frame = frames[fileId];
         histogramMessage = new RegionHistogramData();
         histogramMessage->set_file_id(fileId);
         histogramMessage->set_region_id(regionId);
-        frame->fillRegionHistogramData(regionId, histogramMessage);
+        auto context = taskContexts.start(fileId, regionId, carta::TaskContexts::HISTOGRAM);
+        bool histogramOK(frame->fillRegionHistogramData(regionId, histogramMessage, *context));
+        histogramCancelled = taskContexts.finish(fileId, regionId, carta::TaskContexts::HISTOGRAM, context);
+        if (histogramCancelled) {
+            log(uuid, "Histogram for file {} region {} cancelled ({} cancelled)", fileId, regionId,
+                taskContexts.numCancelled());
+        }
+        if (histogramCancelled || !histogramOK) {
+            delete histogramMessage;
+            histogramMessage = nullptr;
+        }
+    }
+    if (cancelled) {
+        *cancelled = histogramCancelled;
     }
     return histogramMessage;
 }
@@ -191,6 +247,12 @@ CARTA::RegionHistogramData* Session::getRegionHistogramData(const int32_t fileId
 // Compress data
 
 void Session::setCompression(CARTA::CompressionType type, float quality, int nsubsets) {
+    if (type != CompressionType::NONE && type != CompressionType::ZFP) {
+        // SZ is not implemented: send uncompressed data rather than an empty image
+        sendLogEvent("SZ compression is not supported; sending uncompressed image data", {"raster"},
+            CARTA::ErrorSeverity::WARNING);
+        type = CompressionType::NONE;
+    }
     compressionSettings.type = type;
     compressionSettings.quality = quality;
     compressionSettings.nsubsets = nsubsets;
@@ -247,10 +309,15 @@ void Session::onOpenFile(const OpenFile& message, uint32_t requestId) {
         string filename(path.absoluteName());
         // create Frame for open file
         string hdu = fileInfo->hdu_list(0);
-        auto frame = unique_ptr<Frame>(new Frame(uuid, filename, hdu));
+        auto frame = unique_ptr<Frame>(new Frame(uuid, filename, hdu, 0, prefetchChannels, planeCache));
         if (frame->isValid()) {
             ack.set_success(true);
+            frame->setDownsampleFilter(downsampleFilter);
+            // file id reused for a new file: the old file's animation must not outlive it
+            stopAnimation(fileId);
             frames[fileId] = move(frame);
+            std::unique_lock<std::mutex> guard(tileMutex);
+            sentTiles.erase(fileId);
         } else {
             ack.set_success(false);
             ack.set_message("Could not load file");
@@ -264,6 +331,16 @@ void Session::onOpenFile(const OpenFile& message, uint32_t requestId) {
 
 void Session::onCloseFile(const CloseFile& message, uint32_t requestId) {
     auto fileId = message.file_id();
+    stopAnimation(fileId);
+    taskContexts.cancelFile(fileId);
+    {
+        std::unique_lock<std::mutex> guard(tileMutex);
+        if (fileId == -1) {
+            sentTiles.clear();
+        } else {
+            sentTiles.erase(fileId);
+        }
+    }
     if (fileId == -1) {
         for (auto& frame : frames) {
             frame.second.reset();
@@ -298,31 +375,75 @@ void Session::onSetImageView(const SetImageView& message, uint32_t requestId) {
     }
 }
 
+void Session::onSetDownsampleFilter(const CARTA::SetDownsampleFilter& message, uint32_t requestId) {
+    auto fileId(message.file_id());
+    if (frames.count(fileId)) {
+        // applies from the next view: the client follows with SET_IMAGE_VIEW
+        carta::DownsampleFilter filter(downsampleFilter);
+        if (message.filter().empty() || carta::getDownsampleFilter(message.filter(), filter)) {
+            frames[fileId]->setDownsampleFilter(filter);
+        } else {
+            string error = fmt::format("Unknown downsampling filter {}", message.filter());
+            sendLogEvent(error, {"view"}, CARTA::ErrorSeverity::ERROR);
+        }
+    } else {
+        string error = fmt::format("File id {} not found", fileId);
+        sendLogEvent(error, {"view"}, CARTA::ErrorSeverity::DEBUG);
+    }
+}
+
+void Session::onSetCompressionMode(const CARTA::SetCompressionMode& message, uint32_t requestId) {
+    auto mode = carta::CompressionMode::ZFP_PRECISION;
+    for (auto& name : message.modes()) {
+        carta::CompressionMode clientMode;
+        if (carta::getCompressionMode(name, clientMode) && clientMode == serverCompressionMode) {
+            mode = clientMode;
+        }
+    }
+    compressionSettings.mode = mode;
+    CARTA::SetCompressionModeAck ack;
+    ack.set_mode(carta::getCompressionModeName(mode));
+    sendEvent("SET_COMPRESSION_MODE_ACK", requestId, ack);
+}
+
 void Session::onSetImageChannels(const CARTA::SetImageChannels& message, uint32_t requestId) {
+    setImageChannels(message, requestId, false);
+}
+
+bool Session::setImageChannels(const CARTA::SetImageChannels& message, uint32_t requestId, bool animationFrame) {
     auto fileId(message.file_id());
+    bool rasterSent(false);
     if (frames.count(fileId)) {
         auto& frame = frames[fileId];
         size_t newChannel(message.channel()), newStokes(message.stokes());
         bool channelChanged(newChannel != frame->currentChannel()),
              stokesChanged(newStokes != frame->currentStokes());
         if (channelChanged || stokesChanged) {
+            if (stokesChanged) {
+                // histograms, profiles and stats in progress are for the old stokes
+                taskContexts.cancelFile(fileId);
+            }
             string errMessage;
             if (frame->setImageChannels(message.channel(), message.stokes(), errMessage)) {
                 // RESPONSE: updated histogram, spatial profile, spectral profile
                 // Histogram included in the raster image data message
                 RegionHistogramData* histogramData = getRegionHistogramData(fileId, IMAGE_REGION_ID);
-                sendRasterImageData(fileId, requestId, histogramData);
+                rasterSent = sendRasterImageData(fileId, requestId, histogramData, false, animationFrame);
                 sendSpatialProfileData(fileId, CURSOR_REGION_ID);
                 if (stokesChanged)
                     sendSpectralProfileData(fileId, CURSOR_REGION_ID);
             } else {
                 sendLogEvent(errMessage, {"channels"}, CARTA::ErrorSeverity::ERROR);
             }
+        } else if (animationFrame) {
+            // the client acks every frame, even one of the channel it already shows (a one-channel loop)
+            rasterSent = sendRasterImageData(fileId, requestId, nullptr, false, true);
         }
     } else {
         string error = fmt::format("File id {} not found", fileId);
         sendLogEvent(error, {"channels"}, CARTA::ErrorSeverity::DEBUG);
     }
+    return rasterSent;
 }
 
 void Session::onSetCursor(const CARTA::SetCursor& message, uint32_t requestId) {
@@ -360,6 +481,8 @@ void Session::onSetRegion(const CARTA::SetRegion& message, uint32_t requestId) {
             ++regionId; // get next available
             if (regionId == 0) // reserved for cursor
                 ++regionId;
+        } else { // region moved: computations for its old position are obsolete
+            taskContexts.cancelRegion(fileId, regionId);
         }
         std::vector<int> stokes = {message.stokes().begin(), message.stokes().end()};
         std::vector<CARTA::Point> points = {message.control_points().begin(), message.control_points().end()};
@@ -380,8 +503,10 @@ void Session::onSetRegion(const CARTA::SetRegion& message, uint32_t requestId) {
 
 void Session::onRemoveRegion(const CARTA::RemoveRegion& message, uint32_t requestId) {
     auto regionId(message.region_id());
-    for (auto& frame : frames)  // frames = map<fileId, unique_ptr<Frame>>
+    for (auto& frame : frames) { // frames = map<fileId, unique_ptr<Frame>>
+        taskContexts.cancelRegion(frame.first, regionId);
         frame.second->removeRegion(regionId);
+    }
 }
 
 void Session::onSetSpatialRequirements(const CARTA::SetSpatialRequirements& message, uint32_t requestId) {
@@ -410,10 +535,13 @@ void Session::onSetHistogramRequirements(const CARTA::SetHistogramRequirements&
         auto regionId = message.region_id();
         if (frame->setRegionHistogramRequirements(regionId, vector<CARTA::SetHistogramRequirements_HistogramConfig>(message.histograms().begin(), message.histograms().end()))) {
             // RESPONSE
-            RegionHistogramData* histogramData = getRegionHistogramData(fileId, regionId);
+            bool cancelled(false);
+            RegionHistogramData* histogramData = getRegionHistogramData(fileId, regionId, &cancelled);
             if (histogramData != nullptr) {
                 sendFileEvent(fileId, "REGION_HISTOGRAM_DATA", requestId, *histogramData);
-            } else {
+                delete histogramData;
+            } else if (!cancelled) {
+                // a cancelled histogram was superseded by a newer request, and is only logged
                 string error = "Failed to load histogram data";
                 sendLogEvent(error, {"histogram"}, CARTA::ErrorSeverity::ERROR);
             }
@@ -465,9 +593,114 @@ void Session::onSetStatsRequirements(const CARTA::SetStatsRequirements& message,
     }
 }
 
+void Session::onStartAnimation(const CARTA::StartAnimation& message, uint32_t requestId) {
+    auto fileId(message.file_id());
+    stopAnimation(fileId);
+    StartAnimationAck ack;
+    ack.set_success(false);
+    if (frames.count(fileId)) {
+        auto& frame = frames[fileId];
+        carta::AnimationSettings settings;
+        settings.firstChannel = message.first_frame().channel();
+        settings.lastChannel = message.last_frame().channel();
+        settings.startChannel = message.start_frame().channel();
+        settings.deltaChannel = message.delta_frame().channel() ? message.delta_frame().channel() : 1;
+        settings.stokes = message.start_frame().stokes();
+        settings.frameRate = min<double>(message.frame_rate(), ANIMATION_MAX_FRAME_RATE);
+        settings.mode = message.reverse() ? carta::PlaybackMode::BOUNCE
+            : (message.looping() ? carta::PlaybackMode::LOOP : carta::PlaybackMode::ONCE);
+        if (settings.firstChannel < 0 || settings.firstChannel > settings.startChannel
+            || settings.startChannel > settings.lastChannel || settings.lastChannel >= frame->numChannels()) {
+            ack.set_message(fmt::format("Invalid animation channels {}-{} from {}", settings.firstChannel,
+                settings.lastChannel, settings.startChannel));
+        } else if (settings.stokes < 0 || settings.stokes >= frame->numStokes()) {
+            ack.set_message(fmt::format("Invalid animation stokes {}", settings.stokes));
+        } else if (!(settings.frameRate > 0)) {
+            ack.set_message("Invalid animation frame rate");
+        } else {
+            std::unique_lock<std::mutex> guard(animationMutex);
+            int animationId(++animationNumber);
+            // each frame is served as a SET_IMAGE_CHANNELS would be: by a task ordered with the session's
+            // other requests, not on the player's thread
+            auto player = new carta::AnimationPlayer(settings, [this, fileId, requestId, animationId](int channel, int stokes) {
+                postTask([this, fileId, requestId, animationId, channel, stokes]() {
+                    if (animationPlaying(fileId, animationId)) {
+                        SetImageChannels channelMessage;
+                        channelMessage.set_file_id(fileId);
+                        channelMessage.set_channel(channel);
+                        channelMessage.set_stokes(stokes);
+                        if (!setImageChannels(channelMessage, requestId, true)) {
+                            // no ack will come for it
+                            animationFrameSkipped(fileId, animationId);
+                        }
+                    }
+                });
+            });
+            animations[fileId] = make_pair(animationId, unique_ptr<carta::AnimationPlayer>(player));
+            ack.set_success(true);
+            ack.set_animation_id(animationId);
+            // acked before the first frame is queued
+            sendEvent("START_ANIMATION_ACK", requestId, ack);
+            player->start();
+            return;
+        }
+    } else {
+        ack.set_message(fmt::format("File id {} not found", fileId));
+    }
+    sendEvent("START_ANIMATION_ACK", requestId, ack);
+}
+
+void Session::onStopAnimation(const CARTA::StopAnimation& message, uint32_t requestId) {
+    stopAnimation(message.file_id());
+}
+
+void Session::onAnimationFlowControl(const CARTA::AnimationFlowControl& message, uint32_t requestId) {
+    std::unique_lock<std::mutex> guard(animationMutex);
+    auto animation = animations.find(message.file_id());
+    // acks of an animation already replaced are ignored
+    if (animation != animations.end() && animation->second.first == message.animation_id()) {
+        animation->second.second->frameReceived();
+    }
+}
+
+bool Session::animationPlaying(int fileId, int animationId) {
+    std::unique_lock<std::mutex> guard(animationMutex);
+    auto animation = animations.find(fileId);
+    return animation != animations.end() && animation->second.first == animationId;
+}
+
+void Session::animationFrameSkipped(int fileId, int animationId) {
+    std::unique_lock<std::mutex> guard(animationMutex);
+    auto animation = animations.find(fileId);
+    if (animation != animations.end() && animation->second.first == animationId) {
+        animation->second.second->frameSkipped();
+    }
+}
+
+void Session::stopAnimation(int fileId) {
+    vector<unique_ptr<carta::AnimationPlayer>> stopped;
+    {
+        std::unique_lock<std::mutex> guard(animationMutex);
+        for (auto animation = animations.begin(); animation != animations.end();) {
+            if (fileId == -1 || animation->first == fileId) {
+                stopped.push_back(move(animation->second.second));
+                animation = animations.erase(animation);
+            } else {
+                ++animation;
+            }
+        }
+    }
+    // joined outside the lock: acks do not wait for the frame in progress
+    stopped.clear();
+}
+
 // ******** SEND DATA STREAMS *********
 
-void Session::sendRasterImageData(int fileId, uint32_t requestId, CARTA::RegionHistogramData* channelHistogram) {
+bool Session::sendRasterImageData(int fileId, uint32_t requestId, CARTA::RegionHistogramData* channelHistogram,
+    bool fullQuality, bool animationFrame) {
+    if (tiledRaster) {
+        return sendRasterTiles(fileId, requestId, channelHistogram);
+    }
     RasterImageData rasterImageData;
     // Add histogram, if it exists
     if (channelHistogram) {
@@ -475,40 +708,61 @@ void Session::sendRasterImageData(int fileId, uint32_t requestId, CARTA::RegionH
     }
     if (frames.count(fileId)) {
         auto& frame = frames[fileId];
-        auto imageData = frame->getImageData();
+        auto imageBounds = frame->currentBounds();
+        auto mip = frame->currentMip();
+        // adaptive mode: lower precision or coarser mip while the link cannot keep up
+        bool adaptiveFrame = adaptive && compressionSettings.type == CompressionType::ZFP
+            && compressionSettings.mode == carta::CompressionMode::ZFP_PRECISION;
+        carta::AdaptiveQuality::Settings adaptiveSettings{static_cast<int>(lround(compressionSettings.quality)), 1, false};
+        if (adaptiveFrame && !fullQuality) {
+            size_t numPixels = static_cast<size_t>((imageBounds.x_max() - imageBounds.x_min()) / mip)
+                * ((imageBounds.y_max() - imageBounds.y_min()) / mip);
+            adaptiveSettings = adaptiveQuality.choose(adaptiveSettings.precision, numPixels);
+            mip *= adaptiveSettings.mipFactor;
+        }
+        auto imageData = frame->getImageData(imageBounds, mip, frame->currentDownsampleFilter());
         // Check if image data is valid
         if (!imageData.empty()) {
             rasterImageData.set_file_id(fileId);
             rasterImageData.set_stokes(frame->currentStokes());
             rasterImageData.set_channel(frame->currentChannel());
-            rasterImageData.set_mip(frame->currentMip());
+            rasterImageData.set_mip(mip);
             // Copy over image bounds
-            auto imageBounds = frame->currentBounds();
-            auto mip = frame->currentMip();
             rasterImageData.mutable_image_bounds()->set_x_min(imageBounds.x_min());
             rasterImageData.mutable_image_bounds()->set_x_max(imageBounds.x_max());
             rasterImageData.mutable_image_bounds()->set_y_min(imageBounds.y_min());
             rasterImageData.mutable_image_bounds()->set_y_max(imageBounds.y_max());
 
+            // image data is written into the outgoing frame from these buffers, not copied into the message
+            vector<carta::BytesField> fields;
+            // warm zfp streams and buffers, one per subset
+            vector<carta::CompressionContextPool::context_ptr> contexts;
             auto compressionType = compressionSettings.type;
             if (compressionType == CompressionType::NONE) {
                 rasterImageData.set_compression_type(CompressionType::NONE);
                 rasterImageData.set_compression_quality(0);
-                rasterImageData.add_image_data(imageData.data(), imageData.size() * sizeof(float));
+                fields.push_back({RasterImageData::kImageDataFieldNumber, (const char*) imageData.data(),
+                    imageData.size() * sizeof(float)});
             } else if (compressionType == CompressionType::ZFP) {
 
-                int precision = lround(compressionSettings.quality);
+                auto mode = compressionSettings.mode;
+                // whole bits of precision or tolerance exponent; fractional rates are valid
+                float quality = (mode == carta::CompressionMode::ZFP_RATE) ? compressionSettings.quality
+                                                                          : lround(compressionSettings.quality);
+                if (adaptiveFrame) {
+                    quality = adaptiveSettings.precision;
+                }
                 auto rowLength = (imageBounds.x_max() - imageBounds.x_min()) / mip;
                 auto numRows = (imageBounds.y_max() - imageBounds.y_min()) / mip;
                 rasterImageData.set_compression_type(CompressionType::ZFP);
-                rasterImageData.set_compression_quality(precision);
+                rasterImageData.set_compression_quality(quality);
 
-                auto numSubsets(compressionSettings.nsubsets);
-                vector<char> compressionBuffers[numSubsets];
-                vector<size_t> compressedSizes(numSubsets);
-                vector<vector<int32_t>> nanEncodings(numSubsets);
-
-                auto N = min(numSubsets, MAX_SUBSETS);
+                // bands for parallel compression, from the view size and worker threads; the client's
+                // num_subsets is not needed to decode, as it splits rows the same way by the band count
+                auto N = carta::getNumSubsets(rowLength, numRows, tbb::this_task_arena::max_concurrency());
+                for (auto i = 0; i < N; i++) {
+                    contexts.push_back(compressionContexts.acquire());
+                }
                 auto range = tbb::blocked_range<int>(0, N);
                 auto loop = [&](const tbb::blocked_range<int> &r) {
                     for(int i = r.begin(); i != r.end(); ++i) {
@@ -519,8 +773,7 @@ void Session::sendRasterImageData(int fileId, uint32_t requestId, CARTA::RegionH
                         }
                         int subsetElementStart = subsetRowStart * rowLength;
                         int subsetElementEnd = subsetRowEnd * rowLength;
-                        nanEncodings[i] = getNanEncodingsBlock(imageData, subsetElementStart, rowLength, subsetRowEnd - subsetRowStart);
-                        compress(imageData, subsetElementStart, compressionBuffers[i], compressedSizes[i], rowLength, subsetRowEnd - subsetRowStart, precision);
+                        contexts[i]->compress(imageData.data() + subsetElementStart, rowLength, subsetRowEnd - subsetRowStart, mode, quality);
                     }
                 };
                 auto tStartCompress = chrono::high_resolution_clock::now();
@@ -529,30 +782,200 @@ void Session::sendRasterImageData(int fileId, uint32_t requestId, CARTA::RegionH
                 auto dtCompress = chrono::duration_cast<chrono::microseconds>(tEndCompress - tStartCompress).count();
 
                 // Complete message
-                for (auto i = 0; i < numSubsets; i++) {
-                    rasterImageData.add_image_data(compressionBuffers[i].data(), compressedSizes[i]);
-                    rasterImageData.add_nan_encodings((char*) nanEncodings[i].data(), nanEncodings[i].size() * sizeof(int));
+                size_t compressedSize(0);
+                for (auto& context : contexts) {
+                    fields.push_back({RasterImageData::kImageDataFieldNumber, context->buffer.data(), context->compressedSize});
+                    fields.push_back({RasterImageData::kNanEncodingsFieldNumber, (const char*) context->nanEncodings.data(),
+                        context->nanEncodings.size() * sizeof(int32_t)});
+                    compressedSize += context->compressedSize;
+                }
+                if (adaptiveFrame) {
+                    adaptiveQuality.frameSent(numRows * rowLength, quality, compressedSize, adaptiveSettings.degraded);
+                    if (adaptiveSettings.degraded) {
+                        refineFileId = fileId;
+                        refineRequestId = requestId;
+                    }
                 }
 
                 if (verboseLogging) {
-                    string compressionInfo = fmt::format("Image data of size {:.1f} kB compressed to {:.1f} kB in {} ms at {:.2f} MPix/s",
+                    string compressionInfo = fmt::format("Image data of size {:.1f} kB compressed ({} {}, {} subsets) to {:.1f} kB (ratio {:.2f}) in {} ms at {:.2f} MPix/s",
                                numRows * rowLength * sizeof(float) / 1e3,
-                               accumulate(compressedSizes.begin(), compressedSizes.end(), 0) * 1e-3,
+                               carta::getCompressionModeName(mode), quality, N,
+                               compressedSize * 1e-3,
+                               (float) (numRows * rowLength * sizeof(float)) / max(compressedSize, size_t(1)),
                                1e-3 * dtCompress,
                                (float) (numRows * rowLength) / dtCompress);
                     log(uuid, compressionInfo);
                     sendLogEvent(compressionInfo, {"zfp"}, CARTA::ErrorSeverity::DEBUG);
                 }
-            } else {
-                // TODO: error handling for SZ
             }
-            // Send completed event to client
-            sendFileEvent(fileId, "RASTER_IMAGE_DATA", requestId, rasterImageData);
+            // Send completed event to client; a newer view of the file makes it stale, unless it carries
+            // the channel histogram, which later views do not repeat, or is an animation frame the client acks
+            auto dropPolicy = (animationFrame || rasterImageData.has_channel_histogram_data())
+                ? carta::DropPolicy::THROTTLE : carta::DropPolicy::SUPERSEDE;
+            return sendFileEvent(fileId, "RASTER_IMAGE_DATA", requestId, rasterImageData, dropPolicy,
+                supersedeKey("RASTER_IMAGE_DATA", fileId), fields);
         } else {
             string error = "Raster image data failed to load";
             sendLogEvent(error, {"raster"}, CARTA::ErrorSeverity::ERROR);
         }
     }
+    return false;
+}
+
+bool Session::sendRasterTiles(int fileId, uint32_t requestId, CARTA::RegionHistogramData* channelHistogram) {
+    std::unique_ptr<CARTA::RegionHistogramData> histogram(channelHistogram);
+    if (!frames.count(fileId)) {
+        return false;
+    }
+    auto& frame = frames[fileId];
+    auto imageBounds = frame->currentBounds();
+    int mip(frame->currentMip()), channel(frame->currentChannel()), stokes(frame->currentStokes());
+    auto filter = frame->currentDownsampleFilter();
+    casacore::IPosition imageShape(frame->getImageShape());
+    auto compressionType = compressionSettings.type;
+    // mode and quality are not used without compression: they must not split the cached or sent tiles
+    bool zfp(compressionType == CompressionType::ZFP);
+    auto mode = zfp ? compressionSettings.mode : carta::CompressionMode::ZFP_PRECISION;
+    float quality(zfp ? compressionSettings.quality : 0);
+    auto matches = [&](const SentTiles& sent) {
+        return sent.channel == channel && sent.stokes == stokes && sent.type == compressionType && sent.mode == mode
+            && carta::qualityBits(sent.quality) == carta::qualityBits(quality) && sent.filter == filter;
+    };
+
+    // tiles in view which the client does not have yet; marked sent once queued, so a tile that is
+    // skipped or not queued is sent again with the next view
+    std::vector<carta::Tile> tiles;
+    size_t numInView(0);
+    {
+        std::unique_lock<std::mutex> guard(tileMutex);
+        auto& sent = sentTiles[fileId];
+        if (!matches(sent)) {
+            sent.tiles.clear();
+            sent.channel = channel;
+            sent.stokes = stokes;
+            sent.type = compressionType;
+            sent.mode = mode;
+            sent.quality = quality;
+            sent.filter = filter;
+        }
+        for (auto& tile : carta::Tile::getTiles(imageBounds.x_min(), imageBounds.x_max(), imageBounds.y_min(),
+            imageBounds.y_max(), mip)) {
+            ++numInView;
+            if (!sent.tiles.count(tile.encode())) {
+                tiles.push_back(tile);
+            }
+        }
+    }
+    auto markSent = [&](const carta::Tile& tile) {
+        std::unique_lock<std::mutex> guard(tileMutex);
+        auto sent = sentTiles.find(fileId);
+        // not if the file was closed or the client's tiles were reset meanwhile
+        if (sent != sentTiles.end() && matches(sent->second)) {
+            sent->second.tiles.insert(tile.encode());
+        }
+    };
+
+    // compressed tiles are shared with other sessions viewing the same file
+    carta::TileCacheKey cacheKey{frame->getFileName(), frame->getHdu(), channel, stokes, 0,
+        static_cast<int>(compressionType), static_cast<int>(mode), quality, static_cast<int>(filter)};
+    int64_t fileTime(tileCache ? casacore::File(cacheKey.filename).modifyTime() : 0);
+
+    auto tStart = chrono::high_resolution_clock::now();
+    std::atomic<size_t> numSent(0), numBytes(0), numCached(0);
+    std::mutex histogramMutex;
+    auto range = tbb::blocked_range<size_t>(0, tiles.size(), 1);
+    auto loop = [&](const tbb::blocked_range<size_t> &r) {
+        for (size_t t = r.begin(); t != r.end(); ++t) {
+            int xMin, xMax, yMin, yMax;
+            if (!tiles[t].getBounds(imageShape(0), imageShape(1), xMin, xMax, yMin, yMax)) {
+                continue;
+            }
+            CARTA::ImageBounds tileBounds;
+            tileBounds.set_x_min(xMin);
+            tileBounds.set_x_max(xMax);
+            tileBounds.set_y_min(yMin);
+            tileBounds.set_y_max(yMax);
+
+            carta::TileCacheKey tileKey(cacheKey);
+            tileKey.tile = tiles[t].encode();
+            carta::TileCache::tile_ptr compressedTile(tileCache ? tileCache->get(tileKey, fileTime) : nullptr);
+            if (compressedTile) {
+                ++numCached;
+            } else {
+                auto tileData = frame->getImageData(tileBounds, mip, filter);
+                if (tileData.empty()) {
+                    continue;
+                }
+                auto newTile = std::make_shared<carta::CompressedTile>();
+                if (zfp) {
+                    // one subset per tile; tiles are compressed in parallel instead
+                    int rowLength = (xMax - xMin) / mip;
+                    int numRows = (yMax - yMin) / mip;
+                    auto context = compressionContexts.acquire();
+                    context->compress(tileData.data(), rowLength, numRows, mode, quality);
+                    // exact-size copies: the cache budget counts the compressed size
+                    newTile->imageData.assign(context->buffer.data(), context->buffer.data() + context->compressedSize);
+                    newTile->nanEncodings.assign((char*) context->nanEncodings.data(),
+                        (char*) (context->nanEncodings.data() + context->nanEncodings.size()));
+                } else {
+                    newTile->imageData.assign((char*) tileData.data(), (char*) (tileData.data() + tileData.size()));
+                }
+                if (tileCache) {
+                    tileCache->put(tileKey, fileTime, newTile);
+                }
+                compressedTile = newTile;
+            }
+
+            RasterImageData rasterImageData;
+            rasterImageData.set_file_id(fileId);
+            rasterImageData.set_channel(channel);
+            rasterImageData.set_stokes(stokes);
+            rasterImageData.set_mip(mip);
+            *rasterImageData.mutable_image_bounds() = tileBounds;
+            // tile data is written into the outgoing frame from the (cached) tile, not copied into the message
+            vector<carta::BytesField> fields;
+            if (zfp) {
+                rasterImageData.set_compression_type(CompressionType::ZFP);
+                rasterImageData.set_compression_quality(quality);
+                fields.push_back({RasterImageData::kNanEncodingsFieldNumber, compressedTile->nanEncodings.data(),
+                    compressedTile->nanEncodings.size()});
+            } else {
+                rasterImageData.set_compression_type(CompressionType::NONE);
+                rasterImageData.set_compression_quality(0);
+            }
+            fields.push_back({RasterImageData::kImageDataFieldNumber, compressedTile->imageData.data(), compressedTile->imageData.size()});
+            {
+                // with the first tile sent; tiles are sent in parallel, so not necessarily the center one
+                std::unique_lock<std::mutex> guard(histogramMutex);
+                if (histogram) {
+                    rasterImageData.set_allocated_channel_histogram_data(histogram.release());
+                }
+            }
+            // tiles each cover a different part of the view, so they are kept, at the client's pace
+            if (sendFileEvent(fileId, "RASTER_IMAGE_DATA", requestId, rasterImageData, carta::DropPolicy::THROTTLE, 0, fields)) {
+                markSent(tiles[t]);
+                ++numSent;
+                numBytes += compressedTile->size();
+            }
+        }
+    };
+    tbb::parallel_for(range, loop);
+    if (histogram) {
+        // the client already has every tile in view
+        sendFileEvent(fileId, "REGION_HISTOGRAM_DATA", requestId, *histogram);
+    }
+
+    if (verboseLogging) {
+        auto dt = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - tStart).count();
+        log(uuid, "Sent {} of {} tiles in view ({} from cache, {:.1f} kB) in {} ms", numSent.load(), numInView,
+            numCached.load(), numBytes * 1e-3, 1e-3 * dt);
+        if (tileCache) {
+            log(uuid, "Tile cache: {} tiles, {:.1f} MB, {} hits, {} misses", tileCache->numTiles(),
+                tileCache->usedBytes() * 1e-6, tileCache->numHits(), tileCache->numMisses());
+        }
+    }
+    return numSent > 0;
 }
 
 void Session::sendSpatialProfileData(int fileId, int regionId) {
@@ -562,7 +985,9 @@ void Session::sendSpatialProfileData(int fileId, int regionId) {
         if (frame->fillSpatialProfileData(regionId, spatialProfileData)) {
             spatialProfileData.set_file_id(fileId);
             spatialProfileData.set_region_id(regionId);
-            sendFileEvent(fileId, "SPATIAL_PROFILE_DATA", 0, spatialProfileData);
+            // a newer profile of the region makes it stale; other regions' profiles are kept
+            sendFileEvent(fileId, "SPATIAL_PROFILE_DATA", 0, spatialProfileData, carta::DropPolicy::SUPERSEDE,
+                supersedeKey("SPATIAL_PROFILE_DATA", fileId, regionId));
         } else {
             string error = "Spatial profile data failed to load";
             sendLogEvent(error, {"spatial"}, CARTA::ErrorSeverity::ERROR);
@@ -577,7 +1002,18 @@ void Session::sendSpectralProfileData(int fileId, int regionId) {
     if (frames.count(fileId)) {
         auto& frame = frames[fileId];
         CARTA::SpectralProfileData spectralProfileData;
-        if (frame->fillSpectralProfileData(regionId, spectralProfileData)) {
+        auto context = taskContexts.start(fileId, regionId, carta::TaskContexts::SPECTRAL);
+        // partial profiles are streamed while a long profile is computed in channel chunks
+        auto sendPartialProfile = [&](CARTA::SpectralProfileData& partialData) {
+            partialData.set_file_id(fileId);
+            partialData.set_region_id(regionId);
+            sendFileEvent(fileId, "SPECTRAL_PROFILE_DATA", 0, partialData);
+        };
+        bool profileOK(frame->fillSpectralProfileData(regionId, spectralProfileData, *context, sendPartialProfile));
+        if (taskContexts.finish(fileId, regionId, carta::TaskContexts::SPECTRAL, context)) {
+            log(uuid, "Spectral profile for file {} region {} cancelled ({} cancelled)", fileId, regionId,
+                taskContexts.numCancelled());
+        } else if (profileOK) {
             spectralProfileData.set_file_id(fileId);
             spectralProfileData.set_region_id(regionId);
             sendFileEvent(fileId, "SPECTRAL_PROFILE_DATA", 0, spectralProfileData);
@@ -595,7 +1031,12 @@ void Session::sendRegionStatsData(int fileId, int regionId) {
     if (frames.count(fileId)) {
         auto& frame = frames[fileId];
         CARTA::RegionStatsData regionStatsData;
-        if (frame->fillRegionStatsData(regionId, regionStatsData)) {
+        auto context = taskContexts.start(fileId, regionId, carta::TaskContexts::STATS);
+        bool statsOK(frame->fillRegionStatsData(regionId, regionStatsData, *context));
+        if (taskContexts.finish(fileId, regionId, carta::TaskContexts::STATS, context)) {
+            log(uuid, "Region stats for file {} region {} cancelled ({} cancelled)", fileId, regionId,
+                taskContexts.numCancelled());
+        } else if (statsOK) {
             regionStatsData.set_file_id(fileId);
             regionStatsData.set_region_id(regionId);
             sendFileEvent(fileId, "REGION_STATS_DATA", 0, regionStatsData);
@@ -613,32 +1054,92 @@ void Session::sendRegionStatsData(int fileId, int regionId) {
 // SEND uWEBSOCKET MESSAGES
 
 // Sends an event to the client with a given event name (padded/concatenated to 32 characters) and a given ProtoBuf message
-void Session::sendEvent(string eventName, u_int64_t eventId, google::protobuf::MessageLite& message) {
-    static const size_t eventNameLength = 32;
-    int messageLength = message.ByteSize();
-    size_t requiredSize = eventNameLength + 8 + messageLength;
-    std::vector<char> msg(requiredSize, 0);
-    std::copy_n(eventName.begin(), min(eventName.length(), eventNameLength), msg.begin());
-    memcpy(msg.data() + eventNameLength, &eventId, 4);
-    message.SerializeToArray(msg.data() + eventNameLength + 8, messageLength);
-    out_msgs.push(msg);
-    outgoing->send();
+void Session::sendEvent(string eventName, u_int64_t eventId, google::protobuf::MessageLite& message,
+    carta::DropPolicy dropPolicy, uint64_t dropKey, const std::vector<carta::BytesField>& fields) {
+    // reuse the allocation of a message already sent, if any
+    std::vector<char> msg;
+    freeBuffers.try_pop(msg);
+    carta::writeMessageFrame(msg, eventName, eventId, message, fields);
+    adaptiveQuality.queued(msg.size());
+    size_t droppedBytes = out_msgs.push(std::move(msg), dropPolicy, dropKey);
+    if (droppedBytes) {
+        // never reach the socket
+        adaptiveQuality.dropped(droppedBytes);
+        if (verboseLogging) {
+            log(uuid, "Dropped {:.1f} kB of stale messages; {} dropped in total, {:.1f} kB queued",
+                droppedBytes * 1e-3, out_msgs.numDropped(), out_msgs.queuedBytes() * 1e-3);
+        }
+    }
+    std::unique_lock<std::mutex> guard(outgoingMutex);
+    if (outgoing) {
+        outgoing->send();
+    }
     //socket->send(msg.data(), msg.size(), uWS::BINARY);
 }
 
-void Session::sendFileEvent(int32_t fileId, string eventName, u_int64_t eventId,
-    google::protobuf::MessageLite& message) {
+bool Session::sendFileEvent(int32_t fileId, string eventName, u_int64_t eventId,
+    google::protobuf::MessageLite& message, carta::DropPolicy dropPolicy, uint64_t dropKey,
+    const std::vector<carta::BytesField>& fields) {
     // do not send if file is closed
-    if (frames.count(fileId))
-        sendEvent(eventName, eventId, message);
+    if (!frames.count(fileId)) {
+        return false;
+    }
+    sendEvent(eventName, eventId, message, dropPolicy, dropKey, fields);
+    return true;
+}
+
+uint64_t Session::supersedeKey(const char* eventName, int fileId, int regionId) {
+    return (static_cast<uint64_t>(carta::eventNameHash(eventName) & 0xffff) << 48)
+        | (static_cast<uint64_t>(static_cast<uint16_t>(fileId)) << 32) | static_cast<uint32_t>(regionId);
 }
 
 void Session::sendPendingMessages() {
     // Do not parallelize: this must be done serially
     // due to the constraints of uWS.
+    if (!socket || sending) {
+        return;
+    }
+    // uWS buffers whatever the socket cannot take yet without limit: keep at most a window there,
+    // so the rest waits in out_msgs, where stale frames can still be dropped
+    sending = true;
     std::vector<char> msg;
-    while(out_msgs.try_pop(msg)) {
-        socket->send(msg.data(), msg.size(), uWS::BINARY);
+    while (sentBytes < OUTBOUND_SEND_WINDOW && out_msgs.pop(msg)) {
+        // the callback runs once uWS has written the message to the socket, in order
+        sentSizes.push_back(msg.size());
+        sentBytes += msg.size();
+        socket->send(msg.data(), msg.size(), uWS::BINARY,
+            [](uWS::WebSocket<uWS::SERVER>*, void* data, bool cancelled, void*) {
+                // cancelled when the socket closes, possibly after the session is deleted
+                if (!cancelled) {
+                    static_cast<Session*>(data)->onMessageWritten();
+                }
+            }, this);
+        if (msg.capacity() <= OUTBOUND_BUFFER_MAX && freeBuffers.unsafe_size() < OUTBOUND_BUFFER_POOL) {
+            freeBuffers.push(std::move(msg));
+        }
+    }
+    sending = false;
+}
+
+void Session::onMessageWritten() {
+    if (!sentSizes.empty()) {
+        adaptiveQuality.drained(sentSizes.front());
+        sentBytes -= sentSizes.front();
+        sentSizes.pop_front();
+    }
+    // the window has room again
+    sendPendingMessages();
+}
+
+bool Session::refinementDue() {
+    return adaptive && adaptiveQuality.refinementDue();
+}
+
+void Session::sendRefinedRaster() {
+    // the user stopped panning or animating: replace the degraded view at full quality
+    int fileId(refineFileId);
+    if (frames.count(fileId)) {
+        sendRasterImageData(fileId, refineRequestId, nullptr, true);
     }
 }
 
@@ -3,11 +3,15 @@
 #pragma once
 
 #include <fmt/format.h>
+#include <atomic>
+#include <deque>
+#include <functional>
 #include <mutex>
 #include <cstdio>
 #include <uWS/uWS.h>
 #include <cstdint>
 #include <unordered_map>
+#include <unordered_set>
 #include <casacore/casa/aips.h>
 #include <casacore/casa/OS/File.h>
 #include <tbb/concurrent_queue.h>
@@ -23,21 +27,49 @@
 #include <carta-protobuf/set_image_channels.pb.h>
 #include <carta-protobuf/set_image_view.pb.h>
 #include <carta-protobuf/set_cursor.pb.h>
+#include "animation.pb.h"
+#include "downsample_filter.pb.h"
+#include "compression_mode.pb.h"
 
 #include "compression.h"
+#include "AdaptiveQuality.h"
+#include "AnimationPlayer.h"
+#include "MessageFrame.h"
+#include "OutboundQueue.h"
+#include "CompressionContext.h"
 #include "Frame.h"
+#include "RequestCoalescer.h"
+#include "TaskContexts.h"
+#include "Tile.h"
+#include "TileCache.h"
 
-#define MAX_SUBSETS 8
+#define OUTBOUND_BUFFER_POOL 8              // sent message buffers kept for reuse
+#define OUTBOUND_BUFFER_MAX (8 * 1024 * 1024) // larger buffers are freed after sending
+#define OUTBOUND_SEND_WINDOW (4 * 1024 * 1024) // bytes passed to uWS but not yet written; the rest wait in out_msgs
 
 struct CompressionSettings {
     CARTA::CompressionType type;
     float quality;
-    int nsubsets;
+    int nsubsets; // requested by the client; the server picks the band count (getNumSubsets)
+    carta::CompressionMode mode; // encoding used for ZFP: precision unless the client decodes another
+};
+
+// Tiles already sent for a file; reset when channel, stokes, compression or filter changes
+struct SentTiles {
+    int channel;
+    int stokes;
+    CARTA::CompressionType type;
+    carta::CompressionMode mode;
+    float quality;
+    carta::DownsampleFilter filter;
+    std::unordered_set<uint64_t> tiles; // Tile::encode()
 };
 
 class Session {
 public:
     std::string uuid;
+    // queues a function as a task of the session in the thread pool, ordered as a message would be
+    using TaskPoster = std::function<void(std::function<void()> task)>;
 protected:
     // communication
     uWS::WebSocket<uWS::SERVER>* socket;
@@ -54,14 +86,53 @@ protected:
     // <file_id, Frame>: one frame per image file
     std::unordered_map<int, std::unique_ptr<Frame>> frames;
 
-    // Notification mechanism when outgoing messages are ready
+    // Notification mechanism when outgoing messages are ready; nullptr once disconnected
     uS::Async *outgoing;
+    std::mutex outgoingMutex; // tasks notify while the event loop closes it
 
     // for data compression
     CompressionSettings compressionSettings;
+    carta::CompressionContextPool compressionContexts;
+    // compression_mode option: used for clients that decode it (SET_COMPRESSION_MODE)
+    carta::CompressionMode serverCompressionMode;
+
+    // adaptive quality: outbound throughput, and the view to refine once interaction stops
+    bool adaptive;
+    carta::AdaptiveQuality adaptiveQuality;
+    std::deque<size_t> sentSizes; // messages passed to uWS, not yet written; event loop thread only
+    size_t sentBytes; // sum of sentSizes
+    bool sending; // in sendPendingMessages; uWS may call back before send returns
+    std::atomic<int> refineFileId;
+    std::atomic<uint32_t> refineRequestId;
+
+    // raster data sent as fixed-size tiles instead of one message per view
+    bool tiledRaster;
+    std::unordered_map<int, SentTiles> sentTiles; // <file_id, tiles sent>
+    std::mutex tileMutex;
+    carta::TileCache* tileCache; // shared by all sessions; nullptr if disabled
+    carta::ChannelPlaneCache* planeCache; // decoded channel planes of all frames; nullptr if disabled
+
+    // filter for downsampled (mip > 1) raster data of newly opened files; SET_DOWNSAMPLE_FILTER sets it per file
+    carta::DownsampleFilter downsampleFilter;
+
+    // channels read ahead of an animation, per file
+    int prefetchChannels;
+
+    // server-driven animations: <file_id, <animation_id, player>>
+    std::unordered_map<int, std::pair<int, std::unique_ptr<carta::AnimationPlayer>>> animations;
+    std::mutex animationMutex;
+    int animationNumber;
+    TaskPoster postTask; // serves the frames; players never call into the session on their own threads
 
     // Return message queue
-    tbb::concurrent_queue<std::vector<char>> out_msgs;
+    carta::OutboundQueue out_msgs;
+    tbb::concurrent_queue<std::vector<char>> freeBuffers; // sent messages, reused by sendEvent
+
+    // Latest-wins stamps for SET_CURSOR / SET_IMAGE_VIEW
+    carta::RequestCoalescer coalescer;
+
+    // Cancellation of superseded histogram, spectral profile and stats computations
+    carta::TaskContexts taskContexts;
 
 public:
     Session(uWS::WebSocket<uWS::SERVER>* ws,
@@ -70,8 +141,19 @@ public:
             bool enforcePermissions,
             std::string folder,
             uS::Async *outgoing,
-            bool verbose = false);
+            bool verbose = false,
+            bool tiles = false,
+            carta::TileCache* cache = nullptr,
+            carta::DownsampleFilter filter = carta::DownsampleFilter::MEAN,
+            carta::CompressionMode compressionMode = carta::CompressionMode::ZFP_PRECISION,
+            bool adaptive = false,
+            int prefetch = PREFETCH_CHANNELS,
+            carta::ChannelPlaneCache* planes = nullptr,
+            TaskPoster postTask = nullptr);
     ~Session();
+    // Called on the event loop thread when the client disconnects. Tasks may still hold the
+    // session; their messages are no longer sent
+    void disconnect();
 
     // CARTA ICD
     void onRegisterViewer(const CARTA::RegisterViewer& message, uint32_t requestId);
@@ -80,6 +162,8 @@ public:
     void onOpenFile(const CARTA::OpenFile& message, uint32_t requestId);
     void onCloseFile(const CARTA::CloseFile& message, uint32_t requestId);
     void onSetImageView(const CARTA::SetImageView& message, uint32_t requestId);
+    void onSetDownsampleFilter(const CARTA::SetDownsampleFilter& message, uint32_t requestId);
+    void onSetCompressionMode(const CARTA::SetCompressionMode& message, uint32_t requestId);
     void onSetImageChannels(const CARTA::SetImageChannels& message, uint32_t requestId);
     void onSetCursor(const CARTA::SetCursor& message, uint32_t requestId);
     void onSetRegion(const CARTA::SetRegion& message, uint32_t requestId);
@@ -88,8 +172,20 @@ public:
     void onSetHistogramRequirements(const CARTA::SetHistogramRequirements& message, uint32_t requestId);
     void onSetSpectralRequirements(const CARTA::SetSpectralRequirements& message, uint32_t requestId);
     void onSetStatsRequirements(const CARTA::SetStatsRequirements& message, uint32_t requestId);
+    // server-driven animation: frames paced by the server, flow-controlled by client acks
+    void onStartAnimation(const CARTA::StartAnimation& message, uint32_t requestId);
+    void onStopAnimation(const CARTA::StopAnimation& message, uint32_t requestId);
+    void onAnimationFlowControl(const CARTA::AnimationFlowControl& message, uint32_t requestId);
 
     void sendPendingMessages();
+    void onMessageWritten(); // uWS send callback
+    // adaptive quality: true once a degraded view is due to be sent at full quality
+    bool refinementDue();
+    void sendRefinedRaster();
+
+    carta::RequestCoalescer& requestCoalescer() {
+        return coalescer;
+    }
 
 protected:
     // ICD: File list response
@@ -103,20 +199,43 @@ protected:
         const std::string folder, const std::string filename, std::string hdu, std::string& message);
 
     // ICD: Send data streams
-    // raster image data, optionally with histogram
-    void sendRasterImageData(int fileId, uint32_t requestId, CARTA::RegionHistogramData* channelHistogram = nullptr);
-    CARTA::RegionHistogramData* getRegionHistogramData(const int32_t fileId, const int32_t regionId=-1);
+    // raster image data, optionally with histogram. An animation frame is never superseded: the player
+    // waits for the client's ack of each frame it sent. False if nothing was queued
+    bool sendRasterImageData(int fileId, uint32_t requestId, CARTA::RegionHistogramData* channelHistogram = nullptr,
+        bool fullQuality = false, bool animationFrame = false);
+    // tiled mode: tiles of the view the client does not have yet, compressed in parallel and each
+    // sent as a RASTER_IMAGE_DATA with the tile bounds as soon as it is ready
+    bool sendRasterTiles(int fileId, uint32_t requestId, CARTA::RegionHistogramData* channelHistogram);
+    // nullptr if the histogram failed to load, or was cancelled (then *cancelled is set)
+    CARTA::RegionHistogramData* getRegionHistogramData(const int32_t fileId, const int32_t regionId=-1,
+        bool* cancelled = nullptr);
     // profile data
     void sendSpatialProfileData(int fileId, int regionId);
     void sendSpectralProfileData(int fileId, int regionId);
     void sendRegionStatsData(int fileId, int regionId);
 
+    // stops the animation of the file (-1: all files); frames it already queued are skipped
+    void stopAnimation(int fileId);
+    bool animationPlaying(int fileId, int animationId);
+    void animationFrameSkipped(int fileId, int animationId);
+    // SET_IMAGE_CHANNELS, or a frame of a server-driven animation; false if no raster data was queued
+    bool setImageChannels(const CARTA::SetImageChannels& message, uint32_t requestId, bool animationFrame);
+
     // data compression
     void setCompression(CARTA::CompressionType type, float quality, int nsubsets);
 
     // Send protobuf messages
-    void sendEvent(std::string eventName, u_int64_t eventId, google::protobuf::MessageLite& message);
-    void sendFileEvent(int fileId, std::string eventName, u_int64_t eventId, google::protobuf::MessageLite& message);
+    // fields: bytes fields written into the outgoing frame after the message, from buffers it does not own
+    void sendEvent(std::string eventName, u_int64_t eventId, google::protobuf::MessageLite& message,
+        carta::DropPolicy dropPolicy = carta::DropPolicy::KEEP, uint64_t dropKey = 0,
+        const std::vector<carta::BytesField>& fields = {});
+    // false if the file is closed: the message is not queued
+    bool sendFileEvent(int fileId, std::string eventName, u_int64_t eventId, google::protobuf::MessageLite& message,
+        carta::DropPolicy dropPolicy = carta::DropPolicy::KEEP, uint64_t dropKey = 0,
+        const std::vector<carta::BytesField>& fields = {});
+    // SUPERSEDE key of the event's data for a file's region (or view, regionId 0): 16 bits of the event name
+    // hash, then the low 16 bits of the file id and the region id
+    static uint64_t supersedeKey(const char* eventName, int fileId, int regionId = 0);
     void sendLogEvent(std::string message, std::vector<std::string> tags, CARTA::ErrorSeverity severity);
 };
 
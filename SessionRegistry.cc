@@ -0,0 +1,38 @@
+#include "SessionRegistry.h"
+
+using namespace carta;
+
+SessionEntry::SessionEntry(Session* session_, int id_)
+    : session(session_),
+      animationQueue(session_->uuid, [session_](const CARTA::SetImageChannels& message, uint32_t requestId) {
+          session_->onSetImageChannels(message, requestId);
+      }),
+      id(id_),
+      refineTimer(nullptr) {
+}
+
+bool SessionRegistry::add(const std::string& uuid, entry_ptr entry) {
+    return entries.insert(std::make_pair(uuid, std::move(entry)));
+}
+
+SessionRegistry::entry_ptr SessionRegistry::find(const std::string& uuid) {
+    decltype(entries)::const_accessor accessor;
+    if (entries.find(accessor, uuid)) {
+        return accessor->second;
+    }
+    return nullptr;
+}
+
+SessionRegistry::entry_ptr SessionRegistry::remove(const std::string& uuid) {
+    entry_ptr entry;
+    decltype(entries)::accessor accessor;
+    if (entries.find(accessor, uuid)) {
+        entry = std::move(accessor->second);
+        entries.erase(accessor);
+    }
+    return entry;
+}
+
+size_t SessionRegistry::size() {
+    return entries.size();
+}
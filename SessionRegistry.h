@@ -0,0 +1,47 @@
+//# SessionRegistry.h: connected clients by UUID, shared by the event loops and the thread pool tasks
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <tbb/concurrent_hash_map.h>
+#include <uWS/uWS.h>
+
+#include "AnimationQueue.h"
+#include "EventMessage.h"
+#include "Session.h"
+
+namespace carta {
+
+// A connected client: its session and the per-session state of the event loop and the task queues.
+// Held by the registry, the connection and every queued or running task, so it is deleted once the
+// client has disconnected and its last task has finished, on a thread pool thread
+struct SessionEntry {
+    SessionEntry(Session* session, int id);
+
+    std::unique_ptr<Session> session;
+    AnimationQueue animationQueue;
+    EventMessagePool msgPool; // tasks hold the entry, so no pooled message outlives the pool
+    int id;                   // thread pool id, to drop queued tasks on disconnect
+    uS::Timer* refineTimer;   // adaptive quality; event loop thread only
+};
+
+class SessionRegistry {
+public:
+    using entry_ptr = std::shared_ptr<SessionEntry>;
+
+    // false if the UUID is already registered
+    bool add(const std::string& uuid, entry_ptr entry);
+    // nullptr once the client has disconnected
+    entry_ptr find(const std::string& uuid);
+    // the caller's handle (and any task's) keeps the entry alive
+    entry_ptr remove(const std::string& uuid);
+    size_t size();
+
+private:
+    // per-bucket locks: lookups of different sessions never contend
+    tbb::concurrent_hash_map<std::string, entry_ptr> entries;
+};
+
+} // namespace carta
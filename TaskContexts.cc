@@ -0,0 +1,59 @@
+#include "TaskContexts.h"
+
+using namespace carta;
+
+TaskContexts::TaskContexts()
+    : cancelled(0)
+{}
+
+TaskContexts::context_ptr TaskContexts::start(int fileId, int regionId, Kind kind) {
+    // isolated: only cancelled from here, not by the task tree it happens to run in
+    context_ptr context = std::make_shared<tbb::task_group_context>(tbb::task_group_context::isolated);
+    std::unique_lock<std::mutex> guard(mutex);
+    auto& current = running[key_type(fileId, regionId, kind)];
+    if (current) {
+        current->cancel_group_execution();
+    }
+    current = context;
+    return context;
+}
+
+bool TaskContexts::finish(int fileId, int regionId, Kind kind, const context_ptr& context) {
+    std::unique_lock<std::mutex> guard(mutex);
+    auto it = running.find(key_type(fileId, regionId, kind));
+    if (it != running.end() && it->second == context) {
+        running.erase(it);
+    }
+    if (context->is_group_execution_cancelled()) {
+        ++cancelled;
+        return true;
+    }
+    return false;
+}
+
+void TaskContexts::cancelRegion(int fileId, int regionId) {
+    std::unique_lock<std::mutex> guard(mutex);
+    for (auto& entry : running) {
+        if (std::get<0>(entry.first) == fileId && std::get<1>(entry.first) == regionId) {
+            entry.second->cancel_group_execution();
+        }
+    }
+}
+
+void TaskContexts::cancelFile(int fileId) {
+    std::unique_lock<std::mutex> guard(mutex);
+    for (auto& entry : running) {
+        if (fileId == -1 || std::get<0>(entry.first) == fileId) {
+            entry.second->cancel_group_execution();
+        }
+    }
+}
+
+void TaskContexts::cancelAll() {
+    cancelFile(-1);
+}
+
+uint64_t TaskContexts::numCancelled() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return cancelled;
+}
@@ -0,0 +1,45 @@
+//# TaskContexts.h: cancellation of superseded region computations (histograms, spectral profiles, stats)
+
+#pragma once
+
+#include <tbb/task_group.h>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+namespace carta {
+
+class TaskContexts {
+public:
+    enum Kind { HISTOGRAM, SPECTRAL, STATS };
+    using context_ptr = std::shared_ptr<tbb::task_group_context>;
+
+    TaskContexts();
+
+    // Context for a new computation on (fileId, regionId, kind); a computation still running for
+    // the same key is cancelled. Pass the context to parallel algorithms and check it between steps.
+    context_ptr start(int fileId, int regionId, Kind kind);
+    // Called when the computation returns: true (and counted) if it was cancelled
+    bool finish(int fileId, int regionId, Kind kind, const context_ptr& context);
+
+    // Cancel running computations for a region (moved or removed), a file (stokes changed or
+    // closed; fileId -1 for all files), or the whole session
+    void cancelRegion(int fileId, int regionId);
+    void cancelFile(int fileId);
+    void cancelAll();
+
+    // Number of computations that returned cancelled
+    uint64_t numCancelled();
+
+private:
+    using key_type = std::tuple<int, int, int>; // fileId, regionId, kind
+
+    std::mutex mutex;
+    uint64_t cancelled;
+    std::map<key_type, context_ptr> running;
+};
+
+} // namespace carta
@@ -0,0 +1,42 @@
+#include "Tile.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace carta;
+
+uint64_t Tile::encode() const {
+    // 24 bits each for x and y, 16 for mip
+    return (static_cast<uint64_t>(mip & 0xFFFF) << 48) | (static_cast<uint64_t>(y & 0xFFFFFF) << 24)
+        | static_cast<uint64_t>(x & 0xFFFFFF);
+}
+
+bool Tile::getBounds(int width, int height, int& xMin, int& xMax, int& yMin, int& yMax) const {
+    int tileWidth = TILE_SIZE * mip;
+    xMin = x * tileWidth;
+    yMin = y * tileWidth;
+    // whole mip blocks only, as for the view
+    xMax = xMin + std::min(tileWidth, (width - xMin) / mip * mip);
+    yMax = yMin + std::min(tileWidth, (height - yMin) / mip * mip);
+    return (xMax > xMin) && (yMax > yMin);
+}
+
+std::vector<Tile> Tile::getTiles(int xMin, int xMax, int yMin, int yMax, int mip) {
+    std::vector<Tile> tiles;
+    if (mip < 1 || xMax <= xMin || yMax <= yMin) {
+        return tiles;
+    }
+    int tileWidth = TILE_SIZE * mip;
+    for (int j = yMin / tileWidth; j <= (yMax - 1) / tileWidth; ++j) {
+        for (int i = xMin / tileWidth; i <= (xMax - 1) / tileWidth; ++i) {
+            tiles.push_back({i, j, mip});
+        }
+    }
+    // center first, so the part of the view the user is looking at arrives first
+    float xCenter = 0.5f * (xMin + xMax) / tileWidth - 0.5f;
+    float yCenter = 0.5f * (yMin + yMax) / tileWidth - 0.5f;
+    std::stable_sort(tiles.begin(), tiles.end(), [xCenter, yCenter](const Tile& a, const Tile& b) {
+        return std::hypot(a.x - xCenter, a.y - yCenter) < std::hypot(b.x - xCenter, b.y - yCenter);
+    });
+    return tiles;
+}
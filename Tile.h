@@ -0,0 +1,27 @@
+//# Tile.h: fixed-size raster tiles addressed by tile index and mip
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#define TILE_SIZE 256 // tile width and height in pixels at the tile's mip
+
+namespace carta {
+
+struct Tile {
+    int x, y; // tile index; the tile covers TILE_SIZE * mip image pixels along each axis
+    int mip;
+
+    // unique per (x, y, mip), for sets of tiles sent or cached
+    uint64_t encode() const;
+
+    // image pixel bounds covered by the tile, clipped to the image and to whole mip blocks;
+    // false if the tile is outside the image
+    bool getBounds(int width, int height, int& xMin, int& xMax, int& yMin, int& yMax) const;
+
+    // tiles intersecting the view bounds, nearest to the view center first
+    static std::vector<Tile> getTiles(int xMin, int xMax, int yMin, int yMax, int mip);
+};
+
+} // namespace carta
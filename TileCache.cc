@@ -0,0 +1,114 @@
+#include "TileCache.h"
+
+#include <functional>
+
+using namespace carta;
+
+bool TileCacheKey::operator==(const TileCacheKey& other) const {
+    return tile == other.tile && channel == other.channel && stokes == other.stokes
+        && compression == other.compression && mode == other.mode && filter == other.filter
+        && qualityBits(quality) == qualityBits(other.quality) && filename == other.filename && hdu == other.hdu;
+}
+
+size_t TileCacheKeyHash::operator()(const TileCacheKey& key) const {
+    size_t hash = std::hash<std::string>()(key.filename);
+    auto combine = [&hash](size_t value) {
+        hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+    };
+    combine(std::hash<std::string>()(key.hdu));
+    combine(std::hash<uint64_t>()(key.tile));
+    combine(static_cast<size_t>(key.channel) << 32 | static_cast<uint32_t>(key.stokes));
+    combine(static_cast<size_t>(key.compression) << 32 | qualityBits(key.quality));
+    combine(static_cast<size_t>(key.mode) << 32 | static_cast<uint32_t>(key.filter));
+    return hash;
+}
+
+TileCache::TileCache(size_t budgetBytes)
+    : budget(budgetBytes),
+      used(0),
+      hits(0),
+      misses(0)
+{}
+
+void TileCache::erase(std::list<entry_type>::iterator it) {
+    used -= it->second->size();
+    auto file = files.find(it->first.filename);
+    if (!--file->second.numTiles) {
+        files.erase(file);
+    }
+    index.erase(it->first);
+    entries.erase(it);
+}
+
+void TileCache::checkFileTime(const std::string& filename, int64_t mtime) {
+    auto file = files.find(filename);
+    if (file != files.end() && file->second.mtime != mtime) {
+        // file was modified: all its tiles are stale. Erasing the last one drops the file
+        for (auto it = entries.begin(); it != entries.end();) {
+            auto next = std::next(it);
+            if (it->first.filename == filename) {
+                erase(it);
+            }
+            it = next;
+        }
+    }
+}
+
+TileCache::tile_ptr TileCache::get(const TileCacheKey& key, int64_t mtime) {
+    std::unique_lock<std::mutex> guard(mutex);
+    checkFileTime(key.filename, mtime);
+    auto it = index.find(key);
+    if (it == index.end()) {
+        ++misses;
+        return nullptr;
+    }
+    ++hits;
+    entries.splice(entries.begin(), entries, it->second);
+    return it->second->second;
+}
+
+void TileCache::put(const TileCacheKey& key, int64_t mtime, tile_ptr tile) {
+    if (!tile || tile->size() > budget) {
+        return;
+    }
+    std::unique_lock<std::mutex> guard(mutex);
+    checkFileTime(key.filename, mtime);
+    auto it = index.find(key);
+    if (it != index.end()) {
+        erase(it->second);
+    }
+    entries.emplace_front(key, tile);
+    index[key] = entries.begin();
+    used += tile->size();
+    auto& file = files[key.filename];
+    file.mtime = mtime;
+    ++file.numTiles;
+    while (used > budget) {
+        erase(std::prev(entries.end()));
+    }
+}
+
+size_t TileCache::usedBytes() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return used;
+}
+
+size_t TileCache::numTiles() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return entries.size();
+}
+
+uint64_t TileCache::numHits() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return hits;
+}
+
+uint64_t TileCache::numMisses() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return misses;
+}
+
+size_t TileCache::numFiles() {
+    std::unique_lock<std::mutex> guard(mutex);
+    return files.size();
+}
@@ -0,0 +1,89 @@
+//# TileCache.h: process-wide LRU cache of compressed raster tiles, shared by all sessions
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace carta {
+
+// Compression quality as a key: fractional ZFP rates are distinct, and equal qualities hash equally
+inline uint32_t qualityBits(float quality) {
+    uint32_t bits;
+    std::memcpy(&bits, &quality, sizeof(bits));
+    return bits;
+}
+
+struct TileCacheKey {
+    std::string filename;
+    std::string hdu;
+    int channel;
+    int stokes;
+    uint64_t tile;      // Tile::encode(), includes mip
+    int compression;    // CARTA::CompressionType
+    int mode;           // CompressionMode of ZFP
+    float quality;      // ZFP precision, rate or accuracy, as the client requested it
+    int filter;         // DownsampleFilter
+
+    bool operator==(const TileCacheKey& other) const;
+};
+
+struct TileCacheKeyHash {
+    size_t operator()(const TileCacheKey& key) const;
+};
+
+struct CompressedTile {
+    std::vector<char> imageData;
+    std::vector<char> nanEncodings;
+    size_t size() const {
+        return imageData.size() + nanEncodings.size();
+    }
+};
+
+class TileCache {
+public:
+    using tile_ptr = std::shared_ptr<const CompressedTile>;
+
+    TileCache(size_t budgetBytes);
+
+    // nullptr if not cached. mtime is the current modification time of the file: entries
+    // for an older version of the file are dropped
+    tile_ptr get(const TileCacheKey& key, int64_t mtime);
+    // stores the tile, evicting least recently used tiles to stay within the memory budget
+    void put(const TileCacheKey& key, int64_t mtime, tile_ptr tile);
+
+    size_t usedBytes();
+    size_t numTiles();
+    size_t numFiles(); // files with cached tiles
+    uint64_t numHits();
+    uint64_t numMisses();
+
+private:
+    using entry_type = std::pair<TileCacheKey, tile_ptr>;
+    struct FileTiles {
+        int64_t mtime; // of the file when its tiles were cached
+        size_t numTiles;
+    };
+
+    // drops all tiles of the file if it changed since they were cached; mutex held
+    void checkFileTime(const std::string& filename, int64_t mtime);
+    void erase(std::list<entry_type>::iterator it);
+
+    std::mutex mutex;
+    size_t budget;
+    size_t used;
+    uint64_t hits;
+    uint64_t misses;
+    std::list<entry_type> entries; // most recently used first
+    std::unordered_map<TileCacheKey, std::list<entry_type>::iterator, TileCacheKeyHash> index;
+    std::unordered_map<std::string, FileTiles> files; // only files with cached tiles, so it does not grow with every file opened
+};
+
+} // namespace carta
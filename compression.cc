@@ -109,28 +109,34 @@ vector<int32_t> getNanEncodingsSimple(vector<float>& array, int offset, int leng
 }
 
 vector<int32_t> getNanEncodingsBlock(vector<float>& array, int offset, int w, int h) {
+    vector<int32_t> encodedArray;
+    getNanEncodingsBlock(array.data() + offset, w, h, encodedArray);
+    return encodedArray;
+}
+
+void getNanEncodingsBlock(float* data, int w, int h, vector<int32_t>& encodedArray) {
     // Generate RLE NaN list
     int length = w * h;
-    int32_t prevIndex = offset;
+    int32_t prevIndex = 0;
     bool prev = false;
-    vector<int32_t> encodedArray;
+    encodedArray.clear();
 
-    for (auto i = offset; i < offset + length; i++) {
-        bool current = isnan(array[i]);
+    for (auto i = 0; i < length; i++) {
+        bool current = isnan(data[i]);
         if (current != prev) {
             encodedArray.push_back(i - prevIndex);
             prevIndex = i;
             prev = current;
         }
     }
-    encodedArray.push_back(offset + length - prevIndex);
+    encodedArray.push_back(length - prevIndex);
 
     // Skip all-NaN images and NaN-free images
     if (encodedArray.size() > 1) {
         // Calculate average of 4x4 blocks (matching blocks used in ZFP), and replace NaNs with block average
         for (auto i = 0; i < w; i += 4) {
             for (auto j = 0; j < h; j += 4) {
-                int blockStart = offset + j * w + i;
+                int blockStart = j * w + i;
                 int validCount = 0;
                 float sum = 0;
                 // Limit the block size when at the edges of the image
@@ -138,7 +144,7 @@ vector<int32_t> getNanEncodingsBlock(vector<float>& array, int offset, int w, in
                 int blockHeight = min(4, h - j);
                 for (int x = 0; x < blockWidth; x++) {
                     for (int y = 0; y < blockHeight; y++) {
-                        float v = array[blockStart + (y * w) + x];
+                        float v = data[blockStart + (y * w) + x];
                         if (!isnan(v)) {
                             validCount++;
                             sum += v;
@@ -151,9 +157,9 @@ vector<int32_t> getNanEncodingsBlock(vector<float>& array, int offset, int w, in
                     float average = sum / validCount;
                     for (int x = 0; x < blockWidth; x++) {
                         for (int y = 0; y < blockHeight; y++) {
-                            float v = array[blockStart + (y * w) + x];
+                            float v = data[blockStart + (y * w) + x];
                             if (isnan(v)) {
-                                array[blockStart + (y * w) + x] = average;
+                                data[blockStart + (y * w) + x] = average;
                             }
                         }
                     }
@@ -161,5 +167,4 @@ vector<int32_t> getNanEncodingsBlock(vector<float>& array, int offset, int w, in
             }
         }
     }
-    return encodedArray;
 }
@@ -8,3 +8,5 @@ int compress(std::vector<float>& array, size_t offset, std::vector<char>& compre
 int decompress(std::vector<float>& array, std::vector<char>& compressionBuffer, std::size_t& compressedSize, uint32_t nx, uint32_t ny, uint32_t precision);
 std::vector<int32_t> getNanEncodingsSimple(std::vector<float>& array, int offset, int length);
 std::vector<int32_t> getNanEncodingsBlock(std::vector<float>& array, int offset, int w, int h);
+// As above for the w * h block at data, into a reused vector
+void getNanEncodingsBlock(float* data, int w, int h, std::vector<int32_t>& encodedArray);
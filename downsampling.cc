@@ -0,0 +1,304 @@
+#include "downsampling.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CARTA_X86_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace carta;
+
+namespace {
+
+// Vertical pass: add the finite values of one row into per-column sums and counts (or set them,
+// for the first row of the blocks). Rows are contiguous, so this vectorizes.
+void accumulateScalar(const float* row, size_t n, float* sum, float* count, bool first) {
+    for (size_t i = 0; i < n; ++i) {
+        bool finite = std::isfinite(row[i]);
+        float s = first ? 0.0f : sum[i];
+        float c = first ? 0.0f : count[i];
+        sum[i] = finite ? s + row[i] : s;
+        count[i] = finite ? c + 1.0f : c;
+    }
+}
+
+// Horizontal pass: combine the mip columns of each block
+void reduceScalar(const float* sum, const float* count, int mip, size_t begin, size_t nx, float* mean,
+    uint32_t* blockCount) {
+    for (size_t i = begin; i < nx; ++i) {
+        float s = 0.0f, c = 0.0f;
+        for (int dx = 0; dx < mip; ++dx) {
+            s += sum[i * mip + dx];
+            c += count[i * mip + dx];
+        }
+        mean[i] = c ? s / c : NAN;
+        if (blockCount) {
+            blockCount[i] = static_cast<uint32_t>(c);
+        }
+    }
+}
+
+#ifdef CARTA_X86_SIMD
+__attribute__((target("avx2"))) void accumulateAvx2(const float* row, size_t n, float* sum, float* count, bool first) {
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    const __m256 inf = _mm256_set1_ps(INFINITY);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_loadu_ps(row + i);
+        // |v| < inf is false for NaN and inf
+        __m256 finite = _mm256_cmp_ps(_mm256_and_ps(v, absMask), inf, _CMP_LT_OQ);
+        __m256 s = first ? _mm256_setzero_ps() : _mm256_loadu_ps(sum + i);
+        __m256 c = first ? _mm256_setzero_ps() : _mm256_loadu_ps(count + i);
+        _mm256_storeu_ps(sum + i, _mm256_add_ps(s, _mm256_and_ps(finite, v)));
+        _mm256_storeu_ps(count + i, _mm256_add_ps(c, _mm256_and_ps(finite, one)));
+    }
+    accumulateScalar(row + i, n - i, sum + i, count + i, first);
+}
+
+__attribute__((target("avx512f"))) void accumulateAvx512(const float* row, size_t n, float* sum, float* count, bool first) {
+    const __m512 inf = _mm512_set1_ps(INFINITY);
+    const __m512 one = _mm512_set1_ps(1.0f);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 v = _mm512_loadu_ps(row + i);
+        __mmask16 finite = _mm512_cmp_ps_mask(_mm512_abs_ps(v), inf, _CMP_LT_OQ);
+        __m512 s = first ? _mm512_setzero_ps() : _mm512_loadu_ps(sum + i);
+        __m512 c = first ? _mm512_setzero_ps() : _mm512_loadu_ps(count + i);
+        _mm512_storeu_ps(sum + i, _mm512_mask_add_ps(s, finite, s, v));
+        _mm512_storeu_ps(count + i, _mm512_mask_add_ps(c, finite, c, one));
+    }
+    accumulateScalar(row + i, n - i, sum + i, count + i, first);
+}
+
+// sums of adjacent pairs of 16 values, in order
+__attribute__((target("avx2"))) inline __m256 pairSums(const float* p) {
+    __m256 h = _mm256_hadd_ps(_mm256_loadu_ps(p), _mm256_loadu_ps(p + 8));
+    return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(h), 0xD8));
+}
+
+// sums of adjacent quads of 32 values, in order
+__attribute__((target("avx2"))) inline __m256 quadSums(const float* p) {
+    __m256 h1 = _mm256_hadd_ps(_mm256_loadu_ps(p), _mm256_loadu_ps(p + 8));
+    __m256 h2 = _mm256_hadd_ps(_mm256_loadu_ps(p + 16), _mm256_loadu_ps(p + 24));
+    return _mm256_permutevar8x32_ps(_mm256_hadd_ps(h1, h2), _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+__attribute__((target("avx2"))) inline float horizontalSum(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_hadd_ps(s, s);
+    s = _mm_hadd_ps(s, s);
+    return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx2"))) inline void storeMeans(__m256 s, __m256 c, float* mean, uint32_t* blockCount) {
+    __m256 empty = _mm256_cmp_ps(c, _mm256_setzero_ps(), _CMP_EQ_OQ);
+    _mm256_storeu_ps(mean, _mm256_blendv_ps(_mm256_div_ps(s, c), _mm256_set1_ps(NAN), empty));
+    if (blockCount) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(blockCount), _mm256_cvttps_epi32(c));
+    }
+}
+
+__attribute__((target("avx2"))) void reduceAvx2(const float* sum, const float* count, int mip, size_t nx,
+    float* mean, uint32_t* blockCount) {
+    size_t i = 0;
+    if (mip == 2) {
+        for (; i + 8 <= nx; i += 8) {
+            storeMeans(pairSums(sum + 2 * i), pairSums(count + 2 * i), mean + i, blockCount ? blockCount + i : nullptr);
+        }
+    } else if (mip == 4) {
+        for (; i + 8 <= nx; i += 8) {
+            storeMeans(quadSums(sum + 4 * i), quadSums(count + 4 * i), mean + i, blockCount ? blockCount + i : nullptr);
+        }
+    } else if (mip % 8 == 0) {
+        for (; i < nx; ++i) {
+            __m256 s = _mm256_setzero_ps(), c = _mm256_setzero_ps();
+            for (int dx = 0; dx < mip; dx += 8) {
+                s = _mm256_add_ps(s, _mm256_loadu_ps(sum + i * mip + dx));
+                c = _mm256_add_ps(c, _mm256_loadu_ps(count + i * mip + dx));
+            }
+            float blockSum = horizontalSum(s), n = horizontalSum(c);
+            mean[i] = n ? blockSum / n : NAN;
+            if (blockCount) {
+                blockCount[i] = static_cast<uint32_t>(n);
+            }
+        }
+    }
+    reduceScalar(sum, count, mip, i, nx, mean, blockCount);
+}
+#endif
+
+void nearestRow(const float* image, size_t, int mip, size_t nx, float* output) {
+    for (size_t i = 0; i < nx; ++i) {
+        output[i] = image[i * mip];
+    }
+}
+
+// Finite maximum (or minimum) of each block; vertical then horizontal pass as for the mean. Columns
+// start at -inf (+inf), which no finite pixel can equal, so that value marks a block without data.
+template <bool Maximum>
+void blockExtremumRow(const float* image, size_t stride, int mip, size_t nx, float* output) {
+    const float empty = Maximum ? -INFINITY : INFINITY;
+    size_t n = nx * mip;
+    thread_local std::vector<float> columns;
+    columns.assign(n, empty);
+    float* column = columns.data();
+    for (int dy = 0; dy < mip; ++dy) {
+        const float* row = image + dy * stride;
+        for (size_t i = 0; i < n; ++i) {
+            // branch-free, so that the compiler vectorizes it; false for NaN and inf
+            bool finite = std::fabs(row[i]) <= FLT_MAX;
+            bool better = Maximum ? row[i] > column[i] : row[i] < column[i];
+            column[i] = (finite && better) ? row[i] : column[i];
+        }
+    }
+    for (size_t i = 0; i < nx; ++i) {
+        float value = column[i * mip];
+        for (int dx = 1; dx < mip; ++dx) {
+            float v = column[i * mip + dx];
+            value = Maximum ? std::max(value, v) : std::min(value, v);
+        }
+        output[i] = (value == empty) ? NAN : value;
+    }
+}
+
+void blockMedianRow(const float* image, size_t stride, int mip, size_t nx, float* output) {
+    thread_local std::vector<float> values;
+    for (size_t i = 0; i < nx; ++i) {
+        values.clear();
+        for (int dy = 0; dy < mip; ++dy) {
+            const float* row = image + dy * stride + i * mip;
+            for (int dx = 0; dx < mip; ++dx) {
+                if (std::isfinite(row[dx])) {
+                    values.push_back(row[dx]);
+                }
+            }
+        }
+        if (values.empty()) {
+            output[i] = NAN;
+            continue;
+        }
+        auto middle = values.begin() + values.size() / 2;
+        std::nth_element(values.begin(), middle, values.end());
+        float median = *middle;
+        if (values.size() % 2 == 0) {
+            // mean of the two middle values
+            median = 0.5f * (median + *std::max_element(values.begin(), middle));
+        }
+        output[i] = median;
+    }
+}
+
+void meanRow(const float* image, size_t stride, int mip, size_t nx, float* output) {
+    blockMeanRow(image, stride, mip, nx, output);
+}
+
+} // namespace
+
+SimdLevel carta::getSimdLevel() {
+    static const SimdLevel simd = []() {
+#ifdef CARTA_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            return SimdLevel::AVX512;
+        } else if (__builtin_cpu_supports("avx2")) {
+            return SimdLevel::AVX2;
+        }
+#endif
+        return SimdLevel::SCALAR;
+    }();
+    return simd;
+}
+
+void carta::blockMeanRow(const float* image, size_t stride, int mip, size_t nx, float* mean, uint32_t* count) {
+    blockMeanRow(getSimdLevel(), image, stride, mip, nx, mean, count);
+}
+
+void carta::blockMeanRow(SimdLevel simd, const float* image, size_t stride, int mip, size_t nx, float* mean,
+    uint32_t* count) {
+    size_t n = nx * mip;
+    // per-thread column sums and counts, reused across calls
+    thread_local std::vector<float> sums, counts;
+    if (sums.size() < n) {
+        sums.resize(n);
+        counts.resize(n);
+    }
+
+#ifdef CARTA_X86_SIMD
+    if (simd != SimdLevel::SCALAR) {
+        auto accumulate = (simd == SimdLevel::AVX512) ? accumulateAvx512 : accumulateAvx2;
+        for (int dy = 0; dy < mip; ++dy) {
+            accumulate(image + dy * stride, n, sums.data(), counts.data(), dy == 0);
+        }
+        reduceAvx2(sums.data(), counts.data(), mip, nx, mean, count);
+        return;
+    }
+#endif
+    for (int dy = 0; dy < mip; ++dy) {
+        accumulateScalar(image + dy * stride, n, sums.data(), counts.data(), dy == 0);
+    }
+    reduceScalar(sums.data(), counts.data(), mip, 0, nx, mean, count);
+}
+
+bool carta::getDownsampleFilter(const std::string& name, DownsampleFilter& filter) {
+    for (auto candidate : {DownsampleFilter::NEAREST, DownsampleFilter::MEAN, DownsampleFilter::MAX,
+             DownsampleFilter::MIN, DownsampleFilter::MEDIAN}) {
+        if (name == getDownsampleFilterName(candidate)) {
+            filter = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* carta::getDownsampleFilterName(DownsampleFilter filter) {
+    switch (filter) {
+        case DownsampleFilter::NEAREST:
+            return "nearest";
+        case DownsampleFilter::MEAN:
+            return "mean";
+        case DownsampleFilter::MAX:
+            return "max";
+        case DownsampleFilter::MIN:
+            return "min";
+        case DownsampleFilter::MEDIAN:
+            return "median";
+    }
+    return "";
+}
+
+void carta::downsample(DownsampleFilter filter, const float* image, size_t width, int x, int y, int mip,
+    size_t nx, size_t ny, float* output) {
+    using row_kernel_t = void (*)(const float*, size_t, int, size_t, float*);
+    row_kernel_t kernel;
+    switch (filter) {
+        case DownsampleFilter::NEAREST:
+            kernel = nearestRow;
+            break;
+        case DownsampleFilter::MAX:
+            kernel = blockExtremumRow<true>;
+            break;
+        case DownsampleFilter::MIN:
+            kernel = blockExtremumRow<false>;
+            break;
+        case DownsampleFilter::MEDIAN:
+            kernel = blockMedianRow;
+            break;
+        default:
+            kernel = meanRow;
+            break;
+    }
+    // each task handles only its own output rows
+    auto loop = [&](const tbb::blocked_range<size_t>& r) {
+        for (size_t j = r.begin(); j != r.end(); ++j) {
+            kernel(image + (y + j * mip) * width + x, width, mip, nx, output + j * nx);
+        }
+    };
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, ny), loop);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace carta {
+
+enum class SimdLevel { SCALAR, AVX2, AVX512 };
+
+// Best instruction set supported by this CPU, detected once at runtime
+SimdLevel getSimdLevel();
+
+// NaN-aware means of nx consecutive mip x mip blocks. image points to the top-left pixel of the
+// first block and rows are stride pixels apart; blocks without finite pixels are NaN. If count
+// is given, it receives the number of finite pixels in each block.
+void blockMeanRow(const float* image, size_t stride, int mip, size_t nx, float* mean, uint32_t* count = nullptr);
+void blockMeanRow(SimdLevel simd, const float* image, size_t stride, int mip, size_t nx, float* mean,
+    uint32_t* count = nullptr);
+
+// Filters for downsampled views. All except NEAREST ignore NaN and inf pixels; a block without
+// finite pixels is NaN. MAX keeps faint point sources visible at high mip.
+enum class DownsampleFilter { NEAREST, MEAN, MAX, MIN, MEDIAN };
+
+bool getDownsampleFilter(const std::string& name, DownsampleFilter& filter);
+const char* getDownsampleFilterName(DownsampleFilter filter);
+
+// Downsamples nx * ny blocks of mip x mip pixels starting at pixel (x, y) of the image (width
+// pixels per row, x fastest) into output, in parallel over output rows
+void downsample(DownsampleFilter filter, const float* image, size_t width, int x, int y, int mip,
+    size_t nx, size_t ny, float* output);
+
+} // namespace carta
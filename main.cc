@@ -1,17 +1,25 @@
 #include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 #include <fmt/format.h>
 #include <uWS/uWS.h>
 #include <regex>
 #include <fstream>
+#include <functional>
 #include <iostream>
-#include <tuple>
-#include <tbb/concurrent_queue.h>
+#include <cstring>
+#include <memory>
+#include <tbb/task_arena.h>
 #include <tbb/task_scheduler_init.h>
 #include <casacore/casa/OS/HostInfo.h>
 #include <casacore/casa/Inputs/Input.h>
-#include "AnimationQueue.h"
+#include "EventMessage.h"
 #include "Session.h"
+#include "SessionRegistry.h"
+#include "TileCache.h"
 #include "OnMessageTask.h"
+#include "priority_ctpl.h"
 #include "util.h"
 
 #define MAX_THREADS 4
@@ -21,15 +29,66 @@ using namespace uWS;
 
 using key_type = std::string;
 
-unordered_map<key_type, Session*> sessions;
-unordered_map<key_type, carta::AnimationQueue*> animationQueues;
-unordered_map<string, vector<string>> permissionsMap;
-unordered_map<key_type, tbb::concurrent_queue<tuple<string,uint32_t,vector<char>>>*> msgQueues;
-int sessionNumber;
-Hub h;
+// A client is connected, served and disconnected on the event loop whose socket accepted it;
+// tasks on the thread pool hold its registry entry until they finish
+carta::SessionRegistry sessions;
+thread_local Hub* hub; // this thread's event loop
+unordered_map<string, vector<string>> permissionsMap; // read-only once loops start
+std::atomic<int> sessionNumber;
+ctpl::thread_pool* threadPool;
+tbb::task_arena* taskArena; // thread pool tasks and the parallel loops they start
+carta::TileCache* tileCache; // compressed tiles shared by all sessions
+carta::ChannelPlaneCache* planeCache; // decoded channel planes of all open frames
 
 std::string baseFolder("./"), version_id("1.0");
-bool verbose, usePermissions;
+bool verbose, usePermissions, useTiles, useAdaptive;
+int prefetchChannels(PREFETCH_CHANNELS);
+carta::DownsampleFilter downsampleFilter(carta::DownsampleFilter::MEAN);
+carta::CompressionMode compressionMode(carta::CompressionMode::ZFP_PRECISION);
+
+// A thread pool task run in the TBB arena. Once its threads are all busy, the pool thread waits while
+// an arena thread runs the task, so handlers and their parallel loops share the arena's threads
+template <typename Task>
+struct ArenaTask {
+    Task task;
+    void operator()(int threadId) {
+        taskArena->execute([this, threadId]() { task(threadId); });
+    }
+};
+
+template <typename Task>
+ArenaTask<typename std::decay<Task>::type> inArena(Task&& task) {
+    return ArenaTask<typename std::decay<Task>::type>{std::forward<Task>(task)};
+}
+
+// Drops the event loop's handle to a disconnected session on a pool thread. Deleting the session joins
+// its animation and prefetch threads, which must not block the event loop
+struct ReleaseTask {
+    carta::SessionRegistry::entry_ptr entry;
+    void operator()(int) {
+        entry.reset();
+    }
+};
+
+// A function of a session, run as a thread pool task that keeps the session alive
+struct SessionTask {
+    carta::SessionRegistry::entry_ptr entry;
+    std::function<void()> function;
+    void operator()(int) {
+        function();
+    }
+};
+
+// Queues a function of the session (an animation frame) like a SET_IMAGE_CHANNELS: ordered with the
+// session's state changes, in the arena. Dropped once the client has disconnected
+void postSessionTask(const std::string& uuid, std::function<void()> function) {
+    auto entry = sessions.find(uuid);
+    if (entry) {
+        int id(entry->id);
+        // the caller (a player thread) keeps no handle: the session is never deleted on it
+        threadPool->enqueue_ordered(id, carta::PRIORITY_INTERACTIVE, inArena(SessionTask{std::move(entry), std::move(function)}));
+    }
+}
 
 // Reads a permissions file to determine which API keys are required to access various subdirectories
 void readPermissions(string filename) {
@@ -59,20 +118,36 @@ void readPermissions(string filename) {
 
 // Called on connection. Creates session object and assigns UUID and API keys to it
 void onConnect(WebSocket<SERVER>* ws, HttpRequest httpRequest) {
-    std::string uuidstr = fmt::format("{}{}", ++sessionNumber,
+    int sessionId(++sessionNumber);
+    std::string uuidstr = fmt::format("{}{}", sessionId,
         casacore::Int(casacore::HostInfo::secondsFrom1970()));
     ws->setUserData(new std::string(uuidstr));
     auto &uuid = *((std::string*)ws->getUserData());
-    uS::Async *outgoing = new uS::Async(h.getLoop());
+    uS::Async *outgoing = new uS::Async(hub->getLoop());
     outgoing->setData(&uuid);
     outgoing->start(
         [](uS::Async *async) -> void {
-            auto uuid = *((std::string*)async->getData());
-            sessions[uuid]->sendPendingMessages();
+            auto entry = sessions.find(*((std::string*)async->getData()));
+            if (entry) {
+                entry->session->sendPendingMessages();
+            }
         });
-    sessions[uuid] = new Session(ws, uuid, permissionsMap, usePermissions, baseFolder, outgoing, verbose);
-    animationQueues[uuid] = new carta::AnimationQueue(sessions[uuid]);
-    msgQueues[uuid] = new tbb::concurrent_queue<tuple<string,uint32_t,vector<char>>>;
+    auto session = new Session(ws, uuid, permissionsMap, usePermissions, baseFolder, outgoing, verbose, useTiles, tileCache, downsampleFilter, compressionMode, useAdaptive, prefetchChannels, planeCache,
+        [uuidstr](std::function<void()> task) { postSessionTask(uuidstr, std::move(task)); });
+    auto entry = std::make_shared<carta::SessionEntry>(session, sessionId);
+    if (useAdaptive) {
+        // full-quality frames for views that were degraded while the user was interacting
+        entry->refineTimer = new uS::Timer(hub->getLoop());
+        entry->refineTimer->setData(&uuid);
+        entry->refineTimer->start([](uS::Timer* timer) {
+            auto entry = sessions.find(*((std::string*)timer->getData()));
+            if (entry && entry->session->refinementDue()) {
+                threadPool->enqueue(entry->id, carta::PRIORITY_DEFAULT,
+                    inArena([entry](int) { entry->session->sendRefinedRaster(); }));
+            }
+        }, ADAPTIVE_REFINE_CHECK_MS, ADAPTIVE_REFINE_CHECK_MS);
+    }
+    sessions.add(uuid, entry);
     time_t time = chrono::system_clock::to_time_t(chrono::system_clock::now());
     string timeString = ctime(&time);
     timeString = timeString.substr(0, timeString.length() - 1);
@@ -83,14 +158,17 @@ void onConnect(WebSocket<SERVER>* ws, HttpRequest httpRequest) {
 // Called on disconnect. Cleans up sessions. In future, we may want to delay this (in case of unintentional disconnects)
 void onDisconnect(WebSocket<SERVER>* ws, int code, char* message, size_t length) {
     auto &uuid = *((std::string*)ws->getUserData());
-    auto session = sessions[uuid];
-    if (session) {
-        delete session;
-        sessions.erase(uuid);
-        delete animationQueues[uuid];
-        animationQueues.erase(uuid);
-        delete msgQueues[uuid];
-        msgQueues.erase(uuid);
+    auto entry = sessions.remove(uuid);
+    if (entry) {
+        // queued tasks are no longer needed; running tasks keep the entry until they finish
+        threadPool->remove_id(entry->id);
+        if (entry->refineTimer) {
+            entry->refineTimer->stop();
+            entry->refineTimer->close();
+        }
+        entry->session->disconnect();
+        // the session is deleted by this task, or by the last running task of the session
+        threadPool->enqueue(entry->id, carta::PRIORITY_DEFAULT, ReleaseTask{std::move(entry)});
     }
     time_t time = chrono::system_clock::to_time_t(chrono::system_clock::now());
     string timeString = ctime(&time);
@@ -102,35 +180,108 @@ void onDisconnect(WebSocket<SERVER>* ws, int code, char* message, size_t length)
 // Forward message requests to session callbacks after parsing message into relevant ProtoBuf message
 void onMessage(WebSocket<SERVER>* ws, char* rawMessage, size_t length, OpCode opCode) {
     auto uuid = *((std::string*)ws->getUserData());
-    auto session = sessions[uuid];
+    auto entry = sessions.find(uuid);
 
-    if (!session) {
+    if (!entry) {
         fmt::print("Missing session!\n");
         return;
     }
 
     if (opCode == OpCode::BINARY) {
-        if (length > 36) {
-            static const size_t max_len = 32;
-            std::string eventName(rawMessage, std::min(std::strlen(rawMessage), max_len));
-            uint32_t requestId = *reinterpret_cast<uint32_t*>(rawMessage+32);
-            std::vector<char> eventPayload(&rawMessage[36], &rawMessage[length]);
-            msgQueues[uuid]->push(std::make_tuple(eventName, requestId, eventPayload));
-            OnMessageTask *omt = new(tbb::task::allocate_root()) OnMessageTask(
-                uuid, session, msgQueues[uuid], animationQueues[uuid]);
-            if(eventName == "SET_IMAGE_CHANNELS") {
+        if (length > EVENT_HEADER_LENGTH) {
+            // event name resolved once here; tasks dispatch on the enum
+            auto eventType = carta::getEventType(rawMessage, EVENT_NAME_LENGTH);
+            if (eventType == carta::EventType::UNKNOWN) {
+                log(uuid, "Unknown event type {}", std::string(rawMessage, strnlen(rawMessage, EVENT_NAME_LENGTH)));
+                return;
+            }
+            uint32_t requestId;
+            memcpy(&requestId, rawMessage + EVENT_NAME_LENGTH, sizeof(uint32_t));
+            const char* eventPayload = rawMessage + EVENT_HEADER_LENGTH;
+            size_t payloadLength = length - EVENT_HEADER_LENGTH;
+            uint64_t sequence(0);
+            auto priority = carta::getEventPriority(eventType);
+            if (eventType == carta::EventType::SET_IMAGE_CHANNELS) {
                 // has its own queue to keep channels in order during animation
                 CARTA::SetImageChannels message;
-                message.ParseFromArray(eventPayload.data(), eventPayload.size());
-                animationQueues[uuid]->addRequest(message, requestId);
+                message.ParseFromArray(eventPayload, payloadLength);
+                entry->animationQueue.addRequest(message, requestId);
+            } else if (eventType == carta::EventType::ANIMATION_FLOW_CONTROL) {
+                // acks pace the animation: handled at once, not queued behind its frames
+                CARTA::AnimationFlowControl message;
+                if (message.ParseFromArray(eventPayload, payloadLength)) {
+                    entry->session->onAnimationFlowControl(message, requestId);
+                }
+                return;
+            } else if (eventType == carta::EventType::SET_CURSOR || eventType == carta::EventType::SET_IMAGE_VIEW) {
+                // latest wins: tasks for older cursor or view requests on this file are skipped. Only
+                // the file id is read here; the task parses the message
+                int32_t fileId;
+                if (carta::RequestCoalescer::readFileId(eventPayload, payloadLength, fileId)) {
+                    sequence = entry->session->requestCoalescer().stamp(eventType, fileId, requestId);
+                }
+            } else if (eventType == carta::EventType::SET_HISTOGRAM_REQUIREMENTS) {
+                // cube histograms (channel -2) read every channel; don't hold up interactive work
+                CARTA::SetHistogramRequirements message;
+                if (message.ParseFromArray(eventPayload, payloadLength)) {
+                    for (auto& histogram : message.histograms()) {
+                        if (histogram.channel() == -2) {
+                            priority = carta::PRIORITY_HEAVY;
+                        }
+                    }
+                }
+            } else if (eventType == carta::EventType::SET_SPECTRAL_REQUIREMENTS) {
+                // cursor profiles are a single pixel; region profiles read the whole region per channel
+                CARTA::SetSpectralRequirements message;
+                if (message.ParseFromArray(eventPayload, payloadLength) && message.region_id() != CURSOR_REGION_ID) {
+                    priority = carta::PRIORITY_HEAVY;
+                }
+            }
+            // payload is copied once into a pooled envelope, which is owned by the task
+            // the task moves into the pool's queue: no allocation once the pools have warmed up
+            OnMessageTask omt(entry, entry->msgPool.create(eventType, rawMessage, length, sequence));
+            auto ordering = carta::getEventOrdering(eventType);
+            switch (ordering) {
+                case carta::BARRIER:
+                case carta::IN_ORDER:
+                    // starts after the session's earlier state changes, whatever their priority
+                    threadPool->enqueue_ordered(entry->id, priority, inArena(std::move(omt)), ordering == carta::BARRIER);
+                    break;
+                case carta::AFTER_BARRIERS:
+                    // waits for files and regions opened or closed earlier, not for queued heavy work
+                    threadPool->enqueue_after_barriers(entry->id, priority, inArena(std::move(omt)));
+                    break;
+                default:
+                    threadPool->enqueue(entry->id, priority, inArena(std::move(omt)));
+            }
+            if (verbose) {
+                std::string depths;
+                for (auto& depth : threadPool->queue_depths()) {
+                    depths += fmt::format(" {}:{}", depth.first, depth.second);
+                }
+                log(uuid, "Queued {} (priority {}). Queue depths (priority:tasks):{}",
+                    carta::getEventName(eventType), static_cast<int>(priority), depths);
             }
-            tbb::task::enqueue(*omt);
         }
     } else {
         log(uuid, "Invalid event type");
     }
 };
 
+// Sets up the calling thread's event loop and listens on the shared port. Each loop binds its own
+// socket with SO_REUSEPORT, so the kernel spreads new connections across the loops
+bool listenEventLoop(Hub& h, int port) {
+    hub = &h;
+    h.onMessage(&onMessage);
+    h.onConnection(&onConnect);
+    h.onDisconnection(&onDisconnect);
+    if (h.listen(port, nullptr, uS::REUSE_PORT)) {
+        h.getDefaultGroup<uWS::SERVER>().startAutoPing(5000);
+        return true;
+    }
+    return false;
+}
+
 // Entry point. Parses command line arguments and starts server listening
 int main(int argc, const char* argv[]) {
     try {
@@ -143,34 +294,86 @@ int main(int argc, const char* argv[]) {
         inp.create("port", std::to_string(port), "set server port", "Int");
         int threadCount(tbb::task_scheduler_init::default_num_threads());
         inp.create("threads", std::to_string(threadCount), "set thread pool count", "Int");
+        int loopCount(1);
+        inp.create("loops", std::to_string(loopCount), "set number of event loop threads for websocket I/O", "Int");
         inp.create("folder", baseFolder, "set folder for data files", "String");
+        inp.create("tiles", "False", "send raster data as fixed-size tiles", "Bool");
+        int tileCacheSize(512);
+        inp.create("tile_cache", std::to_string(tileCacheSize), "set memory budget (MB) for compressed tiles shared across sessions; 0 to disable", "Int");
+        inp.create("filter", carta::getDownsampleFilterName(downsampleFilter), "set filter for downsampled raster data (nearest, mean, max, min or median)", "String");
+        inp.create("compression_mode", carta::getCompressionModeName(compressionMode), "set encoding of compressed raster data for clients that decode it (precision, rate, accuracy or lossless)", "String");
+        inp.create("adaptive", "False", "adapt compression precision and mip of raster data to the client's bandwidth", "Bool");
+        int planeCacheSize(1024);
+        inp.create("plane_cache", std::to_string(planeCacheSize), "set memory budget (MB) for recently viewed channel planes shared across sessions; 0 to disable", "Int");
+        inp.create("prefetch", std::to_string(prefetchChannels), "set number of channels read ahead of an animation, per file; 0 to disable", "Int");
         inp.readArguments(argc, argv);
 
         verbose = inp.getBool("verbose");
         usePermissions = inp.getBool("permissions");
         port = inp.getInt("port");
         threadCount = inp.getInt("threads");
+        loopCount = std::max(inp.getInt("loops"), 1);
         baseFolder = inp.getString("folder");
+        useTiles = inp.getBool("tiles");
+        tileCacheSize = inp.getInt("tile_cache");
+        planeCacheSize = inp.getInt("plane_cache");
+        useAdaptive = inp.getBool("adaptive");
+        prefetchChannels = std::max(inp.getInt("prefetch"), 0);
+        if (!carta::getDownsampleFilter(inp.getString("filter"), downsampleFilter)) {
+            fmt::print("Unknown filter {}\n", inp.getString("filter"));
+            return 1;
+        }
+        if (!carta::getCompressionMode(inp.getString("compression_mode"), compressionMode)) {
+            fmt::print("Unknown compression mode {}\n", inp.getString("compression_mode"));
+            return 1;
+        }
 
-        // Construct task scheduler, permissions
+        // Construct task scheduler (for parallel loops in handlers), thread pool for ICD events, permissions.
+        // Pool tasks run in an arena of threadCount threads, so the pool threads and TBB workers do not
+        // oversubscribe the cores once handlers start parallel loops
         tbb::task_scheduler_init task_sched(threadCount);
+        tbb::task_arena arena(threadCount);
+        taskArena = &arena;
+        ctpl::thread_pool pool(threadCount);
+        threadPool = &pool;
+        std::unique_ptr<carta::TileCache> cache;
+        if (useTiles && tileCacheSize > 0) {
+            cache.reset(new carta::TileCache(static_cast<size_t>(tileCacheSize) << 20));
+        }
+        tileCache = cache.get();
+        std::unique_ptr<carta::ChannelPlaneCache> planes;
+        if (planeCacheSize > 0) {
+            planes.reset(new carta::ChannelPlaneCache(static_cast<size_t>(planeCacheSize) << 20));
+        }
+        planeCache = planes.get();
         if (usePermissions) {
             readPermissions("permissions.txt");
         }
 
         sessionNumber = 0;
 
-        h.onMessage(&onMessage);
-        h.onConnection(&onConnect);
-        h.onDisconnection(&onDisconnect);
-        if (h.listen(port)) {
-            h.getDefaultGroup<uWS::SERVER>().startAutoPing(5000);
-            fmt::print("Listening on port {} with data folder {} and {} threads in thread pool\n", port, baseFolder, threadCount);
-            h.run();
-        } else {
+        // the main thread runs the first loop; once it is listening, the others join the port
+        Hub h;
+        if (!listenEventLoop(h, port)) {
             fmt::print("Error listening on port {}\n", port);
             return 1;
         }
+        vector<thread> loopThreads;
+        for (int i = 1; i < loopCount; ++i) {
+            loopThreads.emplace_back([port]() {
+                Hub loopHub;
+                if (listenEventLoop(loopHub, port)) {
+                    loopHub.run();
+                } else {
+                    fmt::print("Error listening on port {} for event loop\n", port);
+                }
+            });
+        }
+        fmt::print("Listening on port {} with data folder {}, {} event loops and {} threads in thread pool\n", port, baseFolder, loopCount, threadCount);
+        h.run();
+        for (auto& loopThread : loopThreads) {
+            loopThread.join();
+        }
     }
     catch (exception& e) {
         fmt::print("Error: {}\n", e.what());
@@ -0,0 +1,555 @@
+/*********************************************************
+*
+*  Thread pool with prioritized task queue, based on CTPL
+*  (https://github.com/vit-vit/CTPL, Apache License 2.0).
+*
+*  Tasks are pushed with an id (e.g. the client session) and a
+*  priority. Higher priorities are popped first; tasks with equal
+*  priority run in the order they were pushed. Ordered tasks of one
+*  id start in the order they were pushed, whatever their priority;
+*  tasks pushed after barriers only start after the id's barriers.
+*  Queued tasks can be dropped by id or by priority.
+*
+*********************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <limits>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace ctpl {
+
+namespace detail {
+
+#define CTPL_TASK_INLINE_SIZE 48 // bytes of captured state stored in a task without allocating
+
+// Move-only function of the running thread's id. Unlike std::function it accepts move-only
+// functions, and one that fits in CTPL_TASK_INLINE_SIZE is stored without allocating
+class task {
+public:
+    task() : call(nullptr), relocate(nullptr), destroy(nullptr) {}
+
+    template <typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, task>::value>::type>
+    task(F&& f) {
+        using function_type = typename std::decay<F>::type;
+        init<function_type>(std::forward<F>(f), std::integral_constant<bool, fits<function_type>()>());
+    }
+
+    task(task&& other) : task() {
+        *this = std::move(other);
+    }
+
+    task& operator=(task&& other) {
+        if (this != &other) {
+            reset();
+            if (other.call) {
+                other.relocate(&other.storage, &storage);
+                call = other.call;
+                relocate = other.relocate;
+                destroy = other.destroy;
+                other.call = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    ~task() {
+        reset();
+    }
+
+    void operator()(int threadId) {
+        call(&storage, threadId);
+    }
+
+    explicit operator bool() const {
+        return call != nullptr;
+    }
+
+    // releases the function and its captured state
+    void reset() {
+        if (call) {
+            destroy(&storage);
+            call = nullptr;
+        }
+    }
+
+private:
+    using storage_type = typename std::aligned_storage<CTPL_TASK_INLINE_SIZE>::type;
+
+    template <typename F>
+    static constexpr bool fits() {
+        return sizeof(F) <= sizeof(storage_type) && alignof(storage_type) % alignof(F) == 0
+            && std::is_nothrow_move_constructible<F>::value;
+    }
+
+    template <typename F>
+    struct inline_ops {
+        static F* get(void* storage) {
+            return static_cast<F*>(storage);
+        }
+        static void call(void* storage, int threadId) {
+            (*get(storage))(threadId);
+        }
+        static void relocate(void* from, void* to) {
+            new (to) F(std::move(*get(from)));
+            get(from)->~F();
+        }
+        static void destroy(void* storage) {
+            get(storage)->~F();
+        }
+    };
+
+    template <typename F>
+    struct heap_ops {
+        static F*& get(void* storage) {
+            return *static_cast<F**>(storage);
+        }
+        static void call(void* storage, int threadId) {
+            (*get(storage))(threadId);
+        }
+        static void relocate(void* from, void* to) {
+            new (to) F*(get(from));
+        }
+        static void destroy(void* storage) {
+            delete get(storage);
+        }
+    };
+
+    template <typename F, typename G>
+    void init(G&& f, std::true_type) {
+        new (&storage) F(std::forward<G>(f));
+        set_ops<inline_ops<F>>();
+    }
+
+    template <typename F, typename G>
+    void init(G&& f, std::false_type) {
+        new (&storage) F*(new F(std::forward<G>(f)));
+        set_ops<heap_ops<F>>();
+    }
+
+    template <typename Ops>
+    void set_ops() {
+        call = &Ops::call;
+        relocate = &Ops::relocate;
+        destroy = &Ops::destroy;
+    }
+
+    storage_type storage;
+    void (*call)(void* storage, int threadId);
+    void (*relocate)(void* from, void* to);
+    void (*destroy)(void* storage);
+};
+
+// Items are kept in list nodes, which are reused once popped: after the queue has reached its
+// largest size, pushing does not allocate
+template <typename T>
+class PriorityQueue {
+public:
+    void push(int id, int priority, T const& value) {
+        T copy(value);
+        push(id, priority, std::move(copy));
+    }
+
+    void push(int id, int priority, T&& value) {
+        std::unique_lock<std::mutex> lock(mutex);
+        append(queues[priority], id, false, false, std::move(value));
+    }
+
+    // popped after every ordered item queued earlier with the same id: those with a lower priority
+    // are raised to this one. A session's state changes keep their order, while its priority
+    // still orders them against other sessions' tasks. A barrier is an ordered item that
+    // push_after_barriers items also wait for
+    void push_ordered(int id, int priority, T&& value, bool barrier = false) {
+        std::unique_lock<std::mutex> lock(mutex);
+        raise(id, priority, std::numeric_limits<size_t>::max());
+        append(queues[priority], id, true, barrier, std::move(value));
+    }
+
+    // popped after every barrier queued earlier with the same id, and so after the ordered items
+    // before those; other ordered items are not raised, so queued heavy work of the id does not
+    // delay it. It is not ordered itself
+    void push_after_barriers(int id, int priority, T&& value) {
+        std::unique_lock<std::mutex> lock(mutex);
+        size_t count(0), lastBarrier(0);
+        for (auto it = queues.upper_bound(priority); it != queues.end(); ++it) {
+            for (auto& item : it->second) {
+                if (item.id == id && item.ordered) {
+                    ++count;
+                    if (item.barrier) {
+                        lastBarrier = count;
+                    }
+                }
+            }
+        }
+        raise(id, priority, lastBarrier);
+        append(queues[priority], id, false, false, std::move(value));
+    }
+
+    // pop the oldest item with the highest priority
+    bool pop(T& value) {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (auto& queue : queues) {
+            if (!queue.second.empty()) {
+                value = std::move(queue.second.front().value);
+                release(queue.second, queue.second.begin());
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool empty() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (auto& queue : queues) {
+            if (!queue.second.empty()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t size() {
+        std::unique_lock<std::mutex> lock(mutex);
+        size_t count(0);
+        for (auto& queue : queues) {
+            count += queue.second.size();
+        }
+        return count;
+    }
+
+    // queue depth for each priority with pending items
+    std::map<int, size_t> depths() {
+        std::unique_lock<std::mutex> lock(mutex);
+        std::map<int, size_t> result;
+        for (auto& queue : queues) {
+            if (!queue.second.empty()) {
+                result[queue.first] = queue.second.size();
+            }
+        }
+        return result;
+    }
+
+    void remove_id(int id) {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (auto& queue : queues) {
+            auto& items = queue.second;
+            for (auto item = items.begin(); item != items.end();) {
+                auto next = std::next(item);
+                if (item->id == id) {
+                    release(items, item);
+                }
+                item = next;
+            }
+        }
+    }
+
+    void remove_priority(int priority) {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto it = queues.find(priority);
+        if (it != queues.end()) {
+            while (!it->second.empty()) {
+                release(it->second, it->second.begin());
+            }
+        }
+    }
+
+    void clear() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (auto& queue : queues) {
+            while (!queue.second.empty()) {
+                release(queue.second, queue.second.begin());
+            }
+        }
+    }
+
+private:
+    struct Item {
+        Item(int id_, bool ordered_, bool barrier_, T&& value_)
+            : id(id_), ordered(ordered_), barrier(barrier_), value(std::move(value_)) {}
+        int id;
+        bool ordered;
+        bool barrier;
+        T value;
+    };
+    using item_list = std::list<Item>;
+
+    // mutex held
+    void append(item_list& queue, int id, bool ordered, bool barrier, T&& value) {
+        if (spare.empty()) {
+            queue.emplace_back(id, ordered, barrier, std::move(value));
+        } else {
+            queue.splice(queue.end(), spare, spare.begin());
+            auto& item = queue.back();
+            item.id = id;
+            item.ordered = ordered;
+            item.barrier = barrier;
+            item.value = std::move(value);
+        }
+    }
+
+    // moves the oldest count ordered items of the id with a lower priority to the end of the
+    // priority's queue. The ordered items of an id have non-increasing priorities, oldest first,
+    // so they keep their order; mutex held
+    void raise(int id, int priority, size_t count) {
+        auto& queue = queues[priority];
+        for (auto it = queues.upper_bound(priority); count && it != queues.end(); ++it) {
+            auto& items = it->second;
+            for (auto item = items.begin(); count && item != items.end();) {
+                auto next = std::next(item);
+                if (item->id == id && item->ordered) {
+                    queue.splice(queue.end(), items, item);
+                    --count;
+                }
+                item = next;
+            }
+        }
+    }
+
+    // drops the item's value and keeps its node for reuse; mutex held
+    void release(item_list& queue, typename item_list::iterator item) {
+        item->value = T();
+        spare.splice(spare.begin(), queue, item);
+    }
+
+    // <priority, FIFO of items>, highest priority first; emptied FIFOs are kept for reuse
+    std::map<int, item_list, std::greater<int>> queues;
+    item_list spare; // nodes of popped or removed items
+    std::mutex mutex;
+};
+
+} // namespace detail
+
+class thread_pool {
+public:
+    thread_pool() {
+        init();
+    }
+
+    thread_pool(int nThreads) {
+        init();
+        resize(nThreads);
+    }
+
+    // the destructor waits for all the functions in the queue to be finished
+    ~thread_pool() {
+        stop(true);
+    }
+
+    // get the number of running threads in the pool
+    int size() {
+        return static_cast<int>(threads.size());
+    }
+
+    // number of idle threads
+    int n_idle() {
+        return nWaiting;
+    }
+
+    std::thread& get_thread(int i) {
+        return *threads[i];
+    }
+
+    // change the number of threads in the pool
+    // should be called from one thread, otherwise be careful to not interleave, also with stop()
+    // nThreads must be >= 0
+    void resize(int nThreads) {
+        if (!isStop && !isDone) {
+            int oldNThreads = static_cast<int>(threads.size());
+            if (oldNThreads <= nThreads) { // if the number of threads is increased
+                threads.resize(nThreads);
+                flags.resize(nThreads);
+
+                for (int i = oldNThreads; i < nThreads; ++i) {
+                    flags[i] = std::make_shared<std::atomic<bool>>(false);
+                    set_thread(i);
+                }
+            } else { // the number of threads is decreased
+                for (int i = oldNThreads - 1; i >= nThreads; --i) {
+                    *flags[i] = true; // this thread will finish
+                    threads[i]->detach();
+                }
+                {
+                    // stop the detached threads that were waiting
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.notify_all();
+                }
+                threads.resize(nThreads); // safe to delete because the threads are detached
+                flags.resize(nThreads); // safe to delete because the threads have copies of shared_ptr of the flags, not originals
+            }
+        }
+    }
+
+    // empty the queue
+    void clear_queue() {
+        q.clear();
+    }
+
+    // as push, but the function starts after every ordered function pushed earlier with this id
+    // (see PriorityQueue::push_ordered)
+    template <typename F, typename... Rest>
+    auto push_ordered(int id, int priority, F&& f, Rest&&... rest) -> std::future<decltype(f(0, rest...))> {
+        auto pck = std::make_shared<std::packaged_task<decltype(f(0, rest...))(int)>>(
+            std::bind(std::forward<F>(f), std::placeholders::_1, std::forward<Rest>(rest)...));
+        q.push_ordered(id, priority, detail::task([pck](int threadId) { (*pck)(threadId); }));
+        notify();
+        return pck->get_future();
+    }
+
+    // run the user's function, which receives the id of the running thread, without a future. It may
+    // be move-only; if it fits in a task (CTPL_TASK_INLINE_SIZE), queueing it does not allocate
+    template <typename F>
+    void enqueue(int id, int priority, F&& f) {
+        q.push(id, priority, detail::task(std::forward<F>(f)));
+        notify();
+    }
+
+    // as enqueue, with the order of push_ordered; a barrier also holds back enqueue_after_barriers
+    template <typename F>
+    void enqueue_ordered(int id, int priority, F&& f, bool barrier = false) {
+        q.push_ordered(id, priority, detail::task(std::forward<F>(f)), barrier);
+        notify();
+    }
+
+    // as enqueue, but the function starts after every barrier enqueued earlier with this id
+    // (see PriorityQueue::push_after_barriers)
+    template <typename F>
+    void enqueue_after_barriers(int id, int priority, F&& f) {
+        q.push_after_barriers(id, priority, detail::task(std::forward<F>(f)));
+        notify();
+    }
+
+    // drop queued (not yet running) functions pushed with this id
+    void remove_id(int id) {
+        q.remove_id(id);
+    }
+
+    // drop queued (not yet running) functions pushed with this priority
+    void remove_priority(int priority) {
+        q.remove_priority(priority);
+    }
+
+    // number of queued functions for each priority
+    std::map<int, size_t> queue_depths() {
+        return q.depths();
+    }
+
+    size_t queue_size() {
+        return q.size();
+    }
+
+    // wait for all computing threads to finish and stop all threads
+    // may be called asynchronously to not pause the calling thread while waiting
+    // if isWait == true, all the functions in the queue are run, otherwise the queue is cleared without running the functions
+    void stop(bool isWait = false) {
+        if (!isWait) {
+            if (isStop)
+                return;
+            isStop = true;
+            for (int i = 0, n = size(); i < n; ++i) {
+                *flags[i] = true; // command the threads to stop
+            }
+            clear_queue(); // empty the queue
+        } else {
+            if (isDone || isStop)
+                return;
+            isDone = true; // give the waiting threads a command to finish
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.notify_all(); // stop all waiting threads
+        }
+        for (int i = 0; i < static_cast<int>(threads.size()); ++i) { // wait for the computing threads to finish
+            if (threads[i]->joinable())
+                threads[i]->join();
+        }
+        // if there were no threads in the pool but some functors in the queue, the functors are not deleted by the threads
+        // therefore delete them here
+        clear_queue();
+        threads.clear();
+        flags.clear();
+    }
+
+    // run the user's function; it receives the id of the running thread as first argument
+    template <typename F, typename... Rest>
+    auto push(int id, int priority, F&& f, Rest&&... rest) -> std::future<decltype(f(0, rest...))> {
+        auto pck = std::make_shared<std::packaged_task<decltype(f(0, rest...))(int)>>(
+            std::bind(std::forward<F>(f), std::placeholders::_1, std::forward<Rest>(rest)...));
+        q.push(id, priority, detail::task([pck](int threadId) { (*pck)(threadId); }));
+        notify();
+        return pck->get_future();
+    }
+
+private:
+    // deleted
+    thread_pool(const thread_pool&);
+    thread_pool(thread_pool&&);
+    thread_pool& operator=(const thread_pool&);
+    thread_pool& operator=(thread_pool&&);
+
+    void set_thread(int i) {
+        std::shared_ptr<std::atomic<bool>> flag(flags[i]); // a copy of the shared ptr to the flag
+        auto f = [this, i, flag]() {
+            std::atomic<bool>& stopFlag = *flag;
+            detail::task task;
+            bool isPop = q.pop(task);
+            while (true) {
+                while (isPop) { // if there is anything in the queue
+                    task(i);
+                    task.reset();
+                    if (stopFlag)
+                        return; // the thread is wanted to stop, return even if the queue is not empty yet
+                    else
+                        isPop = q.pop(task);
+                }
+                // the queue is empty here, wait for the next command
+                std::unique_lock<std::mutex> lock(mutex);
+                ++nWaiting;
+                cv.wait(lock, [this, &task, &isPop, &stopFlag]() {
+                    isPop = q.pop(task);
+                    return isPop || isDone || stopFlag;
+                });
+                --nWaiting;
+                if (!isPop)
+                    return; // if the queue is empty and isDone == true or *flag then return
+            }
+        };
+        threads[i].reset(new std::thread(f));
+    }
+
+    void notify() {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.notify_one();
+    }
+
+    void init() {
+        nWaiting = 0;
+        isStop = false;
+        isDone = false;
+    }
+
+    std::vector<std::unique_ptr<std::thread>> threads;
+    std::vector<std::shared_ptr<std::atomic<bool>>> flags;
+    detail::PriorityQueue<detail::task> q;
+    std::atomic<bool> isDone;
+    std::atomic<bool> isStop;
+    std::atomic<int> nWaiting; // how many threads are waiting
+
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+} // namespace ctpl
@@ -0,0 +1,44 @@
+//# AllocationCounter.h: counts heap allocations of a test executable, to check that a code path does not allocate
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Replaces the global operator new and delete: include it in one source file of the executable only.
+// Scalar, array and sized forms are all replaced, so every delete frees a block from the same malloc
+static std::atomic<size_t> allocationCount(0);
+
+static void* countedAllocate(std::size_t size) {
+    ++allocationCount;
+    if (void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size) {
+    return countedAllocate(size);
+}
+
+void* operator new[](std::size_t size) {
+    return countedAllocate(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
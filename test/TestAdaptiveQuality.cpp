@@ -0,0 +1,74 @@
+#include "AdaptiveQuality.h"
+#include <gtest/gtest.h>
+
+using namespace carta;
+using std::chrono::milliseconds;
+
+// Simulates a link of bytesPerSecond: one message of size bytes queued, written after the transfer time
+static void transfer(AdaptiveQuality& adaptive, AdaptiveQuality::clock::time_point& now, size_t bytes,
+    double bytesPerSecond) {
+    adaptive.queued(bytes, now);
+    now += milliseconds(static_cast<int64_t>(1e3 * bytes / bytesPerSecond));
+    adaptive.drained(bytes, now);
+}
+
+TEST(TestAdaptiveQuality, TestUnmeasured) {
+    AdaptiveQuality adaptive;
+    auto settings = adaptive.choose(16, 1000000);
+    EXPECT_EQ(settings.precision, 16);
+    EXPECT_EQ(settings.mipFactor, 1);
+    EXPECT_FALSE(settings.degraded);
+}
+
+TEST(TestAdaptiveQuality, TestThroughput) {
+    AdaptiveQuality adaptive;
+    auto now = AdaptiveQuality::clock::now();
+    // saturated link at 1 MB/s
+    for (int i = 0; i < 5; ++i) {
+        transfer(adaptive, now, 200000, 1e6);
+    }
+    EXPECT_NEAR(adaptive.throughput(), 1e6, 1e5);
+    EXPECT_EQ(adaptive.backlog(), 0);
+
+    // small message written immediately: the link is at least that fast, the estimate stays
+    adaptive.queued(100, now);
+    adaptive.drained(100, now);
+    EXPECT_NEAR(adaptive.throughput(), 1e6, 1e5);
+}
+
+TEST(TestAdaptiveQuality, TestDegradeAndRefine) {
+    AdaptiveQuality adaptive(100);
+    auto now = AdaptiveQuality::clock::now();
+    for (int i = 0; i < 5; ++i) {
+        transfer(adaptive, now, 200000, 1e6);
+    }
+    // 1 MPix at 16 bits precision compressed to 1 MB: 0.5 bits per pixel per bit
+    adaptive.frameSent(1000000, 16, 1000000, false, now);
+
+    // 1 s at full quality on a 1 MB/s link: precision drops to the minimum, then the mip goes up
+    auto settings = adaptive.choose(16, 1000000);
+    EXPECT_TRUE(settings.degraded);
+    EXPECT_EQ(settings.precision, ADAPTIVE_MIN_PRECISION);
+    EXPECT_EQ(settings.mipFactor, ADAPTIVE_MAX_MIP_FACTOR);
+
+    // small view fits within the target at full quality
+    settings = adaptive.choose(16, 10000);
+    EXPECT_FALSE(settings.degraded);
+
+    // precision is enough for a moderately large view
+    settings = adaptive.choose(16, 150000);
+    EXPECT_TRUE(settings.degraded);
+    EXPECT_LT(settings.precision, 16);
+    EXPECT_EQ(settings.mipFactor, 1);
+
+    adaptive.frameSent(150000, settings.precision, 75000, true, now);
+    EXPECT_FALSE(adaptive.refinementDue(now + milliseconds(ADAPTIVE_REFINE_DELAY_MS / 2)));
+    EXPECT_TRUE(adaptive.refinementDue(now + milliseconds(ADAPTIVE_REFINE_DELAY_MS)));
+    // only once
+    EXPECT_FALSE(adaptive.refinementDue(now + milliseconds(2 * ADAPTIVE_REFINE_DELAY_MS)));
+
+    // a full-quality frame cancels a pending refinement
+    adaptive.frameSent(150000, settings.precision, 75000, true, now);
+    adaptive.frameSent(150000, 16, 150000, false, now);
+    EXPECT_FALSE(adaptive.refinementDue(now + milliseconds(ADAPTIVE_REFINE_DELAY_MS)));
+}
@@ -0,0 +1,177 @@
+#include "AnimationPlayer.h"
+#include "OutboundQueue.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace carta;
+
+static AnimationSettings makeSettings(int first, int last, int start, int delta, PlaybackMode mode, double frameRate = 1000) {
+    return AnimationSettings{first, last, start, delta, 0, frameRate, mode};
+}
+
+static std::vector<int> sequence(const AnimationSettings& settings, int count) {
+    std::vector<int> channels;
+    int channel(settings.startChannel), direction(1);
+    channels.push_back(channel);
+    while (static_cast<int>(channels.size()) < count && AnimationPlayer::nextChannel(settings, channel, direction)) {
+        channels.push_back(channel);
+    }
+    return channels;
+}
+
+class FrameLog {
+public:
+    void operator()(int channel, int) {
+        std::unique_lock<std::mutex> guard(mutex);
+        channels.push_back(channel);
+    }
+    std::vector<int> get() {
+        std::unique_lock<std::mutex> guard(mutex);
+        return channels;
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<int> channels;
+};
+
+TEST(TestAnimationPlayer, TestSequences) {
+    EXPECT_EQ(sequence(makeSettings(0, 4, 1, 2, PlaybackMode::ONCE), 10), std::vector<int>({1, 3}));
+    EXPECT_EQ(sequence(makeSettings(0, 4, 3, 1, PlaybackMode::LOOP), 6), std::vector<int>({3, 4, 0, 1, 2, 3}));
+    EXPECT_EQ(sequence(makeSettings(0, 4, 1, -1, PlaybackMode::LOOP), 4), std::vector<int>({1, 0, 4, 3}));
+    EXPECT_EQ(sequence(makeSettings(0, 3, 2, 1, PlaybackMode::BOUNCE), 8), std::vector<int>({2, 3, 2, 1, 0, 1, 2, 3}));
+    EXPECT_EQ(sequence(makeSettings(5, 5, 5, 1, PlaybackMode::BOUNCE), 3), std::vector<int>({5, 5, 5}));
+}
+
+TEST(TestAnimationPlayer, TestPlaysToEnd) {
+    FrameLog log;
+    AnimationPlayer player(makeSettings(0, 9, 0, 1, PlaybackMode::ONCE), [&](int c, int s) { log(c, s); }, 100);
+    player.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    EXPECT_TRUE(player.finished());
+    EXPECT_EQ(log.get(), std::vector<int>({0, 1, 2, 3, 4, 5, 6, 7, 8, 9}));
+}
+
+TEST(TestAnimationPlayer, TestFlowControl) {
+    FrameLog log;
+    AnimationPlayer player(makeSettings(0, 99, 0, 1, PlaybackMode::LOOP), [&](int c, int s) { log(c, s); }, 3);
+    player.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    // no acks: stalls at the window
+    EXPECT_EQ(player.numSent(), 3);
+    player.frameReceived();
+    player.frameReceived();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(player.numSent(), 5);
+    EXPECT_EQ(log.get(), std::vector<int>({0, 1, 2, 3, 4}));
+    player.requestStop();
+    EXPECT_TRUE(player.finished());
+}
+
+TEST(TestAnimationPlayer, TestSkippedFrames) {
+    FrameLog log;
+    AnimationPlayer* playerPtr(nullptr);
+    // odd channels fail to load: nothing is sent, so the client will not ack them
+    AnimationPlayer player(makeSettings(0, 99, 0, 1, PlaybackMode::LOOP), [&](int c, int s) {
+        log(c, s);
+        if (c % 2) {
+            playerPtr->frameSkipped();
+        }
+    }, 2);
+    playerPtr = &player;
+    player.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    // stalls at the window of frames really sent
+    EXPECT_EQ(player.numSent(), 2);
+    EXPECT_EQ(log.get(), std::vector<int>({0, 1, 2}));
+    player.frameReceived();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(player.numSent(), 3);
+    EXPECT_EQ(log.get(), std::vector<int>({0, 1, 2, 3, 4}));
+    player.requestStop();
+}
+
+TEST(TestAnimationPlayer, TestOneChannel) {
+    // every frame is of the same channel, and acked like any other
+    for (auto mode : {PlaybackMode::LOOP, PlaybackMode::BOUNCE}) {
+        FrameLog log;
+        AnimationPlayer player(makeSettings(5, 5, 5, 1, mode), [&](int c, int s) { log(c, s); }, 2);
+        player.start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        EXPECT_EQ(player.numSent(), 2);
+        player.frameReceived();
+        player.frameReceived();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        EXPECT_EQ(player.numSent(), 4);
+        EXPECT_EQ(log.get(), std::vector<int>({5, 5, 5, 5}));
+        EXPECT_FALSE(player.finished());
+        player.requestStop();
+    }
+}
+
+TEST(TestAnimationPlayer, TestFrameRate) {
+    FrameLog log;
+    AnimationPlayer player(makeSettings(0, 999, 0, 1, PlaybackMode::LOOP, 50), [&](int c, int s) { log(c, s); }, 1000);
+    player.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    player.requestStop();
+    // 50 fps for 0.5 s
+    EXPECT_NEAR(player.numSent(), 25, 3);
+}
+
+TEST(TestAnimationPlayer, TestStopWaitsForFrame) {
+    std::atomic<bool> inFrame(false);
+    {
+        AnimationPlayer player(makeSettings(0, 9, 0, 1, PlaybackMode::LOOP), [&](int, int) {
+            inFrame = true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            inFrame = false;
+        });
+        player.start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    // the destructor joined the player after its frame
+    EXPECT_FALSE(inFrame);
+}
+
+// frames queued for a stalled link, then received and acked by the client
+static int receiveFrames(OutboundQueue& queue, AnimationPlayer& player) {
+    int received(0);
+    std::vector<char> message;
+    while (queue.pop(message)) {
+        ++received;
+        player.frameReceived();
+    }
+    return received;
+}
+
+TEST(TestAnimationPlayer, TestSupersededFrames) {
+    const int window(3);
+    for (auto policy : {DropPolicy::SUPERSEDE, DropPolicy::KEEP}) {
+        OutboundQueue queue;
+        AnimationPlayer player(makeSettings(0, 99, 0, 1, PlaybackMode::LOOP), [&](int channel, int) {
+            queue.push(std::vector<char>(16, static_cast<char>(channel)), policy, 1);
+        }, window);
+        player.start();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        int received = receiveFrames(queue, player);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        received += receiveFrames(queue, player);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        player.requestStop();
+        if (policy == DropPolicy::SUPERSEDE) {
+            // superseded frames are never acked: the window stays short by them
+            EXPECT_EQ(queue.numDropped(), window - 1);
+            EXPECT_EQ(player.numSent(), received + window);
+        } else {
+            // every frame reaches the client, so the full window is in flight again
+            EXPECT_EQ(queue.numDropped(), 0);
+            EXPECT_EQ(received, 2 * window);
+            EXPECT_EQ(player.numSent(), 3 * window);
+        }
+    }
+}
@@ -0,0 +1,89 @@
+#include "AnimationQueue.h"
+#include <gtest/gtest.h>
+#include <utility>
+#include <vector>
+
+using namespace carta;
+
+// (file id, channel) of each request served, in order
+class ServedLog {
+public:
+    AnimationQueue::Handler handler() {
+        return [this](const CARTA::SetImageChannels& message, uint32_t requestId) {
+            served.push_back({message.file_id(), message.channel()});
+            requestIds.push_back(requestId);
+        };
+    }
+
+    std::vector<std::pair<int, int>> served;
+    std::vector<uint32_t> requestIds;
+};
+
+static CARTA::SetImageChannels makeRequest(int fileId, int channel) {
+    CARTA::SetImageChannels message;
+    message.set_file_id(fileId);
+    message.set_channel(channel);
+    return message;
+}
+
+static void executeAll(AnimationQueue& queue) {
+    while (queue.executeOne()) {
+    }
+}
+
+TEST(TestAnimationQueue, TestThreshold) {
+    ServedLog log;
+    AnimationQueue queue("test", log.handler(), 3);
+    EXPECT_FALSE(queue.executeOne());
+    // at the threshold: every request is served
+    for (int channel = 0; channel < 3; ++channel) {
+        queue.addRequest(makeRequest(0, channel), channel + 1);
+    }
+    executeAll(queue);
+    EXPECT_EQ(log.served, (std::vector<std::pair<int, int>>{{0, 0}, {0, 1}, {0, 2}}));
+    EXPECT_EQ(log.requestIds, std::vector<uint32_t>({1, 2, 3}));
+    EXPECT_EQ(queue.numDropped(), 0);
+
+    // beyond it: only the newest
+    log.served.clear();
+    for (int channel = 3; channel < 7; ++channel) {
+        queue.addRequest(makeRequest(0, channel), channel + 1);
+    }
+    executeAll(queue);
+    EXPECT_EQ(log.served, (std::vector<std::pair<int, int>>{{0, 6}}));
+    EXPECT_EQ(log.requestIds.back(), 7);
+    EXPECT_EQ(queue.numDropped(), 3);
+}
+
+TEST(TestAnimationQueue, TestNewestPerFile) {
+    ServedLog log;
+    AnimationQueue queue("test", log.handler(), 3);
+    queue.addRequest(makeRequest(0, 0), 1);
+    queue.addRequest(makeRequest(1, 0), 2);
+    queue.addRequest(makeRequest(0, 1), 3);
+    queue.addRequest(makeRequest(0, 2), 4);
+    queue.addRequest(makeRequest(1, 1), 5);
+    queue.addRequest(makeRequest(0, 3), 6);
+    // the newest request of each file, in the order they arrived
+    ASSERT_TRUE(queue.executeOne());
+    EXPECT_EQ(queue.numDropped(), 4);
+    // requests after the skip wait behind the ones kept
+    queue.addRequest(makeRequest(1, 2), 7);
+    executeAll(queue);
+    EXPECT_EQ(log.served, (std::vector<std::pair<int, int>>{{1, 1}, {0, 3}, {1, 2}}));
+    EXPECT_EQ(log.requestIds, std::vector<uint32_t>({5, 6, 7}));
+    EXPECT_EQ(queue.numDropped(), 4);
+}
+
+TEST(TestAnimationQueue, TestReplayAll) {
+    ServedLog log;
+    AnimationQueue queue("test", log.handler(), 0);
+    std::vector<std::pair<int, int>> expected;
+    for (int channel = 0; channel < 20; ++channel) {
+        queue.addRequest(makeRequest(channel % 2, channel), channel);
+        expected.push_back({channel % 2, channel});
+    }
+    executeAll(queue);
+    EXPECT_EQ(log.served, expected);
+    EXPECT_EQ(queue.numDropped(), 0);
+}
@@ -0,0 +1,135 @@
+#include "ChannelPrefetcher.h"
+#include <gtest/gtest.h>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+using namespace carta;
+
+using Channel = std::vector<float>;
+
+class CountingLoader {
+public:
+    CountingLoader(int delayMs = 0) : delay(delayMs) {}
+    void operator()(int channel, int stokes, Channel& data) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+        data.assign(16, static_cast<float>(channel * 10 + stokes));
+        std::unique_lock<std::mutex> guard(mutex);
+        loaded.insert(channel);
+    }
+    std::set<int> channels() {
+        std::unique_lock<std::mutex> guard(mutex);
+        return loaded;
+    }
+
+private:
+    int delay;
+    std::mutex mutex;
+    std::set<int> loaded;
+};
+
+// waits for the prefetch thread, as a client waits for the previous frame
+static void settle() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+}
+
+// reads a channel like Frame: from the prefetcher, or from the loader on a miss
+static Channel request(ChannelPrefetcher<Channel>& prefetcher, CountingLoader& loader, int channel, int depth) {
+    auto data = prefetcher.take(channel, 0, depth);
+    if (data) {
+        return *data;
+    }
+    Channel direct;
+    loader(channel, 0, direct);
+    return direct;
+}
+
+TEST(TestChannelPrefetcher, TestNoPatternNoPrefetch) {
+    CountingLoader loader;
+    ChannelPrefetcher<Channel> prefetcher([&](int c, int s, Channel& d) { loader(c, s, d); });
+    for (int channel : {5, 2, 9, 4}) {
+        EXPECT_FALSE(prefetcher.take(channel, 0, 100));
+        settle();
+    }
+    EXPECT_TRUE(loader.channels().empty());
+    EXPECT_EQ(prefetcher.numHits(), 0);
+}
+
+TEST(TestChannelPrefetcher, TestForwardAnimation) {
+    CountingLoader loader, direct;
+    ChannelPrefetcher<Channel> prefetcher([&](int c, int s, Channel& d) { loader(c, s, d); }, 2);
+    for (int channel = 0; channel < 3; ++channel) {
+        request(prefetcher, direct, channel, 100);
+    }
+    settle();
+    EXPECT_EQ(loader.channels(), std::set<int>({3, 4}));
+    for (int channel = 3; channel < 20; ++channel) {
+        auto data = prefetcher.take(channel, 0, 100);
+        ASSERT_TRUE(data) << channel;
+        EXPECT_EQ((*data)[0], channel * 10);
+        settle();
+    }
+    EXPECT_EQ(prefetcher.numHits(), 17);
+    EXPECT_EQ(prefetcher.numMisses(), 0);
+}
+
+TEST(TestChannelPrefetcher, TestStrideAndWrap) {
+    CountingLoader loader, direct;
+    ChannelPrefetcher<Channel> prefetcher([&](int c, int s, Channel& d) { loader(c, s, d); }, 2);
+    // backwards with stride 3, wrapping below channel 0
+    for (int channel : {7, 4, 1}) {
+        request(prefetcher, direct, channel, 10);
+    }
+    settle();
+    EXPECT_EQ(loader.channels(), std::set<int>({8, 5}));
+    auto data = prefetcher.take(8, 0, 10);
+    ASSERT_TRUE(data);
+    EXPECT_EQ((*data)[0], 80);
+}
+
+TEST(TestChannelPrefetcher, TestStokesChangeRestarts) {
+    CountingLoader loader, direct;
+    ChannelPrefetcher<Channel> prefetcher([&](int c, int s, Channel& d) { loader(c, s, d); }, 2);
+    for (int channel = 0; channel < 3; ++channel) {
+        request(prefetcher, direct, channel, 100);
+    }
+    settle();
+    // channel 3 was read ahead for stokes 0 only
+    EXPECT_FALSE(prefetcher.take(3, 1, 100));
+    EXPECT_EQ(prefetcher.numHits(), 0);
+}
+
+TEST(TestChannelPrefetcher, TestWaitsForRead) {
+    CountingLoader loader(100), direct;
+    ChannelPrefetcher<Channel> prefetcher([&](int c, int s, Channel& d) { loader(c, s, d); }, 1);
+    for (int channel = 0; channel < 3; ++channel) {
+        request(prefetcher, direct, channel, 100);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    // channel 3 is being read: served from that read, not read again
+    auto data = prefetcher.take(3, 0, 100);
+    ASSERT_TRUE(data);
+    EXPECT_EQ((*data)[0], 30);
+    EXPECT_TRUE(direct.channels().count(3) == 0);
+}
+
+TEST(TestChannelPrefetcher, TestOverlap) {
+    // each channel: read (disk) then compress (CPU), the client requesting the next one when done
+    const int readMs = 20, processMs = 20, numChannels = 20;
+    CountingLoader loader(readMs), direct(readMs);
+    auto run = [&](bool prefetch) {
+        ChannelPrefetcher<Channel> prefetcher([&](int c, int s, Channel& d) { loader(c, s, d); }, prefetch ? 2 : 0);
+        auto tStart = std::chrono::high_resolution_clock::now();
+        for (int channel = 0; channel < numChannels; ++channel) {
+            request(prefetcher, direct, channel, 100);
+            std::this_thread::sleep_for(std::chrono::milliseconds(processMs));
+        }
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - tStart).count();
+    };
+    double serial = run(false), overlapped = run(true);
+    std::cout << "Animation of " << numChannels << " channels: " << serial << " ms serial, " << overlapped << " ms with prefetch"
+              << std::endl;
+    EXPECT_LT(overlapped, serial * 0.8);
+}
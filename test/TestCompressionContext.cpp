@@ -0,0 +1,223 @@
+#include "CompressionContext.h"
+#include "compression.h"
+#include "AllocationCounter.h" // a warm context must not allocate
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+#include <vector>
+#include <zlib.h>
+
+using namespace carta;
+
+static std::vector<float> makeImage(size_t width, size_t height) {
+    std::vector<float> image(width * height);
+    for (size_t k = 0; k < image.size(); ++k) {
+        image[k] = (k % 17 == 3) ? NAN : std::sin(0.01f * k);
+    }
+    return image;
+}
+
+TEST(TestCompressionContext, TestMatchesCompress) {
+    const uint32_t width = 123, height = 45, precision = 14;
+    auto image = makeImage(width, height);
+    const auto original = image;
+
+    std::vector<char> buffer;
+    size_t compressedSize;
+    auto nanEncodings = getNanEncodingsBlock(image, 0, width, height);
+    ASSERT_EQ(compress(image, 0, buffer, compressedSize, width, height, precision), 0);
+
+    CompressionContext context;
+    ASSERT_EQ(context.compress(original.data(), width, height, precision), 0);
+    EXPECT_EQ(context.nanEncodings, nanEncodings);
+    ASSERT_EQ(context.compressedSize, compressedSize);
+    EXPECT_TRUE(std::equal(buffer.begin(), buffer.begin() + compressedSize, context.buffer.begin()));
+
+    // the context can be reused for a different size
+    auto small = makeImage(16, 8);
+    ASSERT_EQ(context.compress(small.data(), 16, 8, precision), 0);
+    std::vector<float> decompressed(16 * 8);
+    ASSERT_EQ(decompress(decompressed, context.buffer, context.compressedSize, 16, 8, precision), 0);
+    for (size_t i = 0; i < decompressed.size(); ++i) {
+        if (!std::isnan(small[i])) {
+            EXPECT_NEAR(decompressed[i], small[i], 1e-2);
+        }
+    }
+}
+
+TEST(TestCompressionContext, TestUnmodified) {
+    auto image = makeImage(64, 64);
+    const auto original = image;
+    CompressionContext context;
+    ASSERT_EQ(context.compress(image.data(), 64, 64, 12), 0);
+    for (size_t i = 0; i < image.size(); ++i) {
+        EXPECT_TRUE(image[i] == original[i] || (std::isnan(image[i]) && std::isnan(original[i])));
+    }
+}
+
+TEST(TestCompressionContext, TestThroughput) {
+    const uint32_t width = 4096, height = 4096, precision = 12;
+    const auto image = makeImage(width, height);
+    std::vector<float> copy(image);
+    std::vector<char> buffer;
+    size_t compressedSize;
+    CompressionContext context;
+    for (int rep = 0; rep < 2; ++rep) {
+        // three passes: NaN encoding, NaN fill, zfp (which modify the image in place)
+        copy = image;
+        auto tStart = std::chrono::high_resolution_clock::now();
+        getNanEncodingsBlock(copy, 0, width, height);
+        compress(copy, 0, buffer, compressedSize, width, height, precision);
+        double dtThreePass = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tStart).count();
+
+        tStart = std::chrono::high_resolution_clock::now();
+        context.compress(image.data(), width, height, precision);
+        double dtFused = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tStart).count();
+        EXPECT_EQ(context.compressedSize, compressedSize);
+        std::cout << "three-pass " << width * height * 1e-6 / dtThreePass << " MPix/s, fused "
+                  << width * height * 1e-6 / dtFused << " MPix/s" << std::endl;
+    }
+}
+
+TEST(TestCompressionContext, TestLossless) {
+    const uint32_t width = 100, height = 30;
+    auto image = makeImage(width, height);
+    CompressionContext context;
+    ASSERT_EQ(context.compress(image.data(), width, height, CompressionMode::LOSSLESS, 0), 0);
+    EXPECT_TRUE(context.nanEncodings.empty());
+
+    // inflate and unshuffle the byte planes
+    size_t length = image.size();
+    std::vector<char> shuffled(length * sizeof(float));
+    uLongf shuffledSize = shuffled.size();
+    ASSERT_EQ(uncompress(reinterpret_cast<Bytef*>(shuffled.data()), &shuffledSize,
+                  reinterpret_cast<const Bytef*>(context.buffer.data()), context.compressedSize), Z_OK);
+    ASSERT_EQ(shuffledSize, shuffled.size());
+    std::vector<float> decoded(length);
+    char* bytes = reinterpret_cast<char*>(decoded.data());
+    for (size_t b = 0; b < sizeof(float); ++b) {
+        for (size_t i = 0; i < length; ++i) {
+            bytes[i * sizeof(float) + b] = shuffled[b * length + i];
+        }
+    }
+    EXPECT_EQ(std::memcmp(decoded.data(), image.data(), length * sizeof(float)), 0);
+}
+
+TEST(TestCompressionContext, TestModes) {
+    CompressionMode mode;
+    for (auto candidate : {CompressionMode::ZFP_PRECISION, CompressionMode::ZFP_RATE, CompressionMode::ZFP_ACCURACY,
+             CompressionMode::LOSSLESS}) {
+        ASSERT_TRUE(getCompressionMode(getCompressionModeName(candidate), mode));
+        EXPECT_EQ(mode, candidate);
+    }
+    EXPECT_FALSE(getCompressionMode("sz", mode));
+
+    // ratio and throughput per mode
+    const uint32_t width = 2048, height = 2048;
+    const auto image = makeImage(width, height);
+    struct {
+        CompressionMode mode;
+        float quality;
+    } settings[] = {{CompressionMode::ZFP_PRECISION, 12}, {CompressionMode::ZFP_RATE, 8},
+        {CompressionMode::ZFP_ACCURACY, 10}, {CompressionMode::LOSSLESS, 0}};
+    CompressionContext context;
+    for (auto& setting : settings) {
+        context.compress(image.data(), width, height, setting.mode, setting.quality); // warm up
+        auto tStart = std::chrono::high_resolution_clock::now();
+        ASSERT_EQ(context.compress(image.data(), width, height, setting.mode, setting.quality), 0);
+        double dt = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tStart).count();
+        std::cout << getCompressionModeName(setting.mode) << " " << setting.quality << ": ratio "
+                  << image.size() * sizeof(float) / double(context.compressedSize) << ", "
+                  << image.size() * 1e-6 / dt << " MPix/s" << std::endl;
+    }
+}
+
+TEST(TestCompressionContext, TestSteadyStateAllocations) {
+    const uint32_t width = 512, height = 256, precision = 12;
+    auto image = makeImage(width, height);
+    CompressionContext context;
+    context.compress(image.data(), width, height, precision);
+
+    // same frame size again, as during animation
+    size_t before = allocationCount;
+    ASSERT_EQ(context.compress(image.data(), width, height, precision), 0);
+    EXPECT_EQ(allocationCount - before, 0);
+}
+
+TEST(TestCompressionContext, TestPool) {
+    CompressionContextPool pool(2);
+    EXPECT_EQ(pool.numContexts(), 2);
+    CompressionContext* first;
+    {
+        auto a = pool.acquire();
+        auto b = pool.acquire();
+        first = a.get();
+        EXPECT_NE(a.get(), b.get());
+        // more than reserved
+        auto c = pool.acquire();
+        EXPECT_EQ(pool.numContexts(), 3);
+    }
+    // released contexts are handed out again
+    auto d = pool.acquire();
+    auto e = pool.acquire();
+    auto f = pool.acquire();
+    EXPECT_EQ(pool.numContexts(), 3);
+    EXPECT_TRUE(d.get() == first || e.get() == first || f.get() == first);
+}
+
+TEST(TestCompressionContext, TestNumSubsets) {
+    // small views are not split
+    EXPECT_EQ(getNumSubsets(64, 64, 8), 1);
+    EXPECT_EQ(getNumSubsets(256, 256, 8), 1);
+    // at least SUBSET_MIN_PIXELS per band
+    EXPECT_EQ(getNumSubsets(512, 512, 8), 4);
+    // one band per thread for large views, beyond the old limit of 8
+    EXPECT_EQ(getNumSubsets(4096, 4096, 32), 32);
+    EXPECT_EQ(getNumSubsets(4096, 4096, 4), 4);
+    // wide and short: at least SUBSET_MIN_ROWS rows per band
+    EXPECT_EQ(getNumSubsets(1 << 20, 8, 16), 2);
+    EXPECT_EQ(getNumSubsets(0, 0, 8), 1);
+    EXPECT_EQ(getNumSubsets(4096, 4096, 0), 1);
+}
+
+// Compresses in N row bands in parallel, split as in Session::sendRasterImageData
+static double compressBands(CompressionContextPool& pool, const std::vector<float>& image, int rowLength, int numRows,
+    int N) {
+    std::vector<CompressionContextPool::context_ptr> contexts;
+    for (int i = 0; i < N; ++i) {
+        contexts.push_back(pool.acquire());
+    }
+    auto tStart = std::chrono::high_resolution_clock::now();
+    tbb::parallel_for(tbb::blocked_range<int>(0, N), [&](const tbb::blocked_range<int>& r) {
+        for (int i = r.begin(); i != r.end(); ++i) {
+            int rowStart = i * (numRows / N);
+            int rowEnd = (i == N - 1) ? numRows : (i + 1) * (numRows / N);
+            contexts[i]->compress(image.data() + rowStart * rowLength, rowLength, rowEnd - rowStart, 12);
+        }
+    });
+    return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tStart).count();
+}
+
+TEST(TestCompressionContext, TestSubsetThroughput) {
+    int numThreads = tbb::this_task_arena::max_concurrency();
+    CompressionContextPool pool;
+    for (int size : {128, 256, 512, 1024, 2048, 4096}) {
+        auto image = makeImage(size, size);
+        int policy = getNumSubsets(size, size, numThreads);
+        std::cout << size << "x" << size << " (policy " << policy << "):";
+        for (int N : {1, 4, 8, numThreads, policy}) {
+            compressBands(pool, image, size, size, N); // warm up
+            double dt = 1e9;
+            for (int rep = 0; rep < 3; ++rep) {
+                dt = std::min(dt, compressBands(pool, image, size, size, N));
+            }
+            std::cout << " " << N << ": " << size * size * 1e-6 / dt << " MPix/s";
+        }
+        std::cout << std::endl;
+    }
+}
@@ -0,0 +1,193 @@
+#include "downsampling.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace carta;
+
+static std::vector<float> makeImage(size_t width, size_t height) {
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::vector<float> image(width * height);
+    for (size_t k = 0; k < image.size(); ++k) {
+        image[k] = (k % 13 == 0) ? NAN : (k % 101 == 0) ? -INFINITY : dist(rng);
+    }
+    return image;
+}
+
+static std::vector<SimdLevel> supportedLevels() {
+    std::vector<SimdLevel> levels = {SimdLevel::SCALAR};
+    if (getSimdLevel() != SimdLevel::SCALAR) {
+        levels.push_back(SimdLevel::AVX2);
+    }
+    if (getSimdLevel() == SimdLevel::AVX512) {
+        levels.push_back(SimdLevel::AVX512);
+    }
+    return levels;
+}
+
+// Mean filter loop as previously in Frame::getImageData: per-pixel access, pixelY innermost
+static void legacyMean(const std::vector<float>& image, size_t width, int mip, size_t nx, size_t ny,
+    std::vector<float>& output) {
+    for (size_t j = 0; j < ny; ++j) {
+        for (size_t i = 0; i < nx; ++i) {
+            float pixelSum = 0;
+            int pixelCount = 0;
+            for (auto pixelX = 0; pixelX < mip; pixelX++) {
+                for (auto pixelY = 0; pixelY < mip; pixelY++) {
+                    auto imageRow = j * mip + pixelY;
+                    auto imageCol = i * mip + pixelX;
+                    float pixVal = image[imageRow * width + imageCol];
+                    if (!std::isnan(pixVal) && !std::isinf(pixVal)) {
+                        pixelCount++;
+                        pixelSum += pixVal;
+                    }
+                }
+            }
+            output[j * nx + i] = pixelCount ? pixelSum / pixelCount : NAN;
+        }
+    }
+}
+
+TEST(TestDownsampling, TestBlockMean) {
+    const size_t width = 333, height = 64;
+    auto image = makeImage(width, height);
+    for (int mip : {1, 2, 3, 4, 8, 16}) {
+        size_t nx = (width - 5) / mip, ny = height / mip;
+        std::vector<float> expected(nx * ny), actual(nx);
+        std::vector<uint32_t> count(nx);
+        // offset start column: unaligned rows
+        std::vector<float> shifted(image.begin() + 5, image.end());
+        legacyMean(shifted, width, mip, nx, ny, expected);
+        for (auto simd : supportedLevels()) {
+            for (size_t j = 0; j < ny; ++j) {
+                blockMeanRow(simd, image.data() + j * mip * width + 5, width, mip, nx, actual.data(), count.data());
+                for (size_t i = 0; i < nx; ++i) {
+                    float e = expected[j * nx + i];
+                    if (std::isnan(e)) {
+                        EXPECT_TRUE(std::isnan(actual[i]));
+                        EXPECT_EQ(count[i], 0);
+                    } else {
+                        EXPECT_NEAR(actual[i], e, 1e-5) << "simd " << int(simd) << " mip " << mip;
+                        EXPECT_GT(count[i], 0);
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST(TestDownsampling, TestThroughput) {
+    const size_t width = 4096, height = 4096;
+    auto image = makeImage(width, height);
+    for (int mip : {2, 4, 16}) {
+        size_t nx = width / mip, ny = height / mip;
+        std::vector<float> output(nx * ny);
+        auto tStart = std::chrono::high_resolution_clock::now();
+        legacyMean(image, width, mip, nx, ny, output);
+        double dtLegacy = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tStart).count();
+        std::cout << "mip " << mip << ": legacy loop " << width * height * 1e-6 / dtLegacy << " MPix/s";
+        for (auto simd : supportedLevels()) {
+            tStart = std::chrono::high_resolution_clock::now();
+            for (size_t j = 0; j < ny; ++j) {
+                blockMeanRow(simd, image.data() + j * mip * width, width, mip, nx, output.data() + j * nx);
+            }
+            double dt = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tStart).count();
+            const char* names[] = {"scalar", "AVX2", "AVX-512"};
+            std::cout << ", " << names[int(simd)] << " " << width * height * 1e-6 / dt << " MPix/s";
+        }
+        std::cout << std::endl;
+    }
+}
+
+static const std::vector<DownsampleFilter> allFilters = {DownsampleFilter::NEAREST, DownsampleFilter::MEAN,
+    DownsampleFilter::MAX, DownsampleFilter::MIN, DownsampleFilter::MEDIAN};
+
+// Reference value of one block from its finite pixels
+static float referenceBlock(DownsampleFilter filter, const std::vector<float>& image, size_t width, size_t x0,
+    size_t y0, int mip) {
+    if (filter == DownsampleFilter::NEAREST) {
+        return image[y0 * width + x0];
+    }
+    std::vector<float> values;
+    for (int dy = 0; dy < mip; ++dy) {
+        for (int dx = 0; dx < mip; ++dx) {
+            float v = image[(y0 + dy) * width + x0 + dx];
+            if (std::isfinite(v)) {
+                values.push_back(v);
+            }
+        }
+    }
+    if (values.empty()) {
+        return NAN;
+    }
+    std::sort(values.begin(), values.end());
+    size_t n = values.size();
+    switch (filter) {
+        case DownsampleFilter::MAX:
+            return values.back();
+        case DownsampleFilter::MIN:
+            return values.front();
+        case DownsampleFilter::MEDIAN:
+            return n % 2 ? values[n / 2] : 0.5f * (values[n / 2 - 1] + values[n / 2]);
+        default: {
+            double sum = 0;
+            for (float v : values) {
+                sum += v;
+            }
+            return sum / n;
+        }
+    }
+}
+
+TEST(TestDownsampling, TestFilters) {
+    const size_t width = 333, height = 97;
+    const int x = 5, y = 3;
+    auto image = makeImage(width, height);
+    for (auto filter : allFilters) {
+        DownsampleFilter parsed;
+        ASSERT_TRUE(getDownsampleFilter(getDownsampleFilterName(filter), parsed));
+        EXPECT_EQ(parsed, filter);
+        for (int mip : {1, 2, 3, 4, 8}) {
+            size_t nx = (width - x) / mip, ny = (height - y) / mip;
+            std::vector<float> output(nx * ny, -1.0f);
+            downsample(filter, image.data(), width, x, y, mip, nx, ny, output.data());
+            for (size_t j = 0; j < ny; ++j) {
+                for (size_t i = 0; i < nx; ++i) {
+                    float e = referenceBlock(filter, image, width, x + i * mip, y + j * mip, mip);
+                    float a = output[j * nx + i];
+                    if (std::isnan(e)) {
+                        EXPECT_TRUE(std::isnan(a));
+                    } else if (std::isinf(e)) {
+                        EXPECT_EQ(a, e); // nearest neighbour only
+                    } else {
+                        EXPECT_NEAR(a, e, 1e-5) << getDownsampleFilterName(filter) << " mip " << mip;
+                    }
+                }
+            }
+        }
+    }
+    DownsampleFilter unknown;
+    EXPECT_FALSE(getDownsampleFilter("gaussian", unknown));
+}
+
+TEST(TestDownsampling, TestFilterThroughput) {
+    const size_t width = 4096, height = 4096;
+    auto image = makeImage(width, height);
+    for (int mip : {2, 4, 16}) {
+        size_t nx = width / mip, ny = height / mip;
+        std::vector<float> output(nx * ny);
+        std::cout << "mip " << mip;
+        for (auto filter : allFilters) {
+            auto tStart = std::chrono::high_resolution_clock::now();
+            downsample(filter, image.data(), width, 0, 0, mip, nx, ny, output.data());
+            double dt = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - tStart).count();
+            std::cout << ", " << getDownsampleFilterName(filter) << " " << width * height * 1e-6 / dt << " MPix/s";
+        }
+        std::cout << std::endl;
+    }
+}
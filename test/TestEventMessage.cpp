@@ -0,0 +1,105 @@
+#include "EventMessage.h"
+#include "AllocationCounter.h" // so the ingress path can be compared before/after pooling
+#include <gtest/gtest.h>
+#include <tbb/concurrent_queue.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+static std::vector<char> makeFrame(const std::string& eventName, uint32_t requestId, size_t payloadSize) {
+    std::vector<char> frame(EVENT_HEADER_LENGTH + payloadSize, 0);
+    std::copy_n(eventName.begin(), std::min(eventName.size(), (size_t) EVENT_NAME_LENGTH), frame.begin());
+    std::memcpy(frame.data() + EVENT_NAME_LENGTH, &requestId, sizeof(uint32_t));
+    for (size_t i = 0; i < payloadSize; ++i) {
+        frame[EVENT_HEADER_LENGTH + i] = static_cast<char>(i);
+    }
+    return frame;
+}
+
+TEST(TestEventMessage, TestCreate) {
+    carta::EventMessagePool pool(4);
+    auto frame = makeFrame("SET_SPATIAL_REQUIREMENTS", 17, 12);
+    auto msg = pool.create(carta::getEventType(frame.data(), EVENT_NAME_LENGTH), frame.data(), frame.size());
+
+    EXPECT_EQ(msg->eventType, carta::EventType::SET_SPATIAL_REQUIREMENTS);
+    EXPECT_EQ(msg->requestId, 17);
+    EXPECT_EQ(msg->sequence, 0);
+    ASSERT_EQ(msg->payload.size(), 12);
+    EXPECT_EQ(msg->payload[11], 11);
+}
+
+TEST(TestEventMessage, TestGrowAndReuse) {
+    carta::EventMessagePool pool(2);
+    std::vector<carta::EventMessagePool::message_ptr> messages;
+    for (uint32_t i = 0; i < 5; ++i) {
+        auto frame = makeFrame("SET_CURSOR", i, 8);
+        messages.push_back(pool.create(carta::EventType::SET_CURSOR, frame.data(), frame.size(), i + 1));
+    }
+    for (uint32_t i = 0; i < 5; ++i) {
+        EXPECT_EQ(messages[i]->requestId, i);
+        EXPECT_EQ(messages[i]->sequence, i + 1);
+    }
+    // slab grew by three envelopes, which are retained for reuse
+    messages.clear();
+    EXPECT_EQ(pool.numPooled(), 5);
+    EXPECT_EQ(pool.numAllocated(), 3);
+    auto frame = makeFrame("SET_CURSOR", 0, 8);
+    auto msg = pool.create(carta::EventType::SET_CURSOR, frame.data(), frame.size());
+    EXPECT_EQ(pool.numPooled(), 5);
+}
+
+TEST(TestEventMessage, TestEventTypeLookup) {
+    for (size_t i = 0; i < carta::NUM_EVENT_TYPES; ++i) {
+        auto type = static_cast<carta::EventType>(i);
+        auto frame = makeFrame(carta::getEventName(type), 0, 0);
+        EXPECT_EQ(carta::getEventType(frame.data(), EVENT_NAME_LENGTH), type);
+    }
+    auto unknown = makeFrame("SET_CURSORS", 0, 0);
+    EXPECT_EQ(carta::getEventType(unknown.data(), EVENT_NAME_LENGTH), carta::EventType::UNKNOWN);
+    auto prefix = makeFrame("SET_", 0, 0);
+    EXPECT_EQ(carta::getEventType(prefix.data(), EVENT_NAME_LENGTH), carta::EventType::UNKNOWN);
+    // unterminated name filling the whole header field
+    std::string longName(EVENT_NAME_LENGTH, 'A');
+    auto full = makeFrame(longName, 0, 0);
+    EXPECT_EQ(carta::getEventType(full.data(), EVENT_NAME_LENGTH), carta::EventType::UNKNOWN);
+}
+
+TEST(TestEventMessage, TestAllocationsPerMessage) {
+    const size_t numMessages = 10000;
+    auto frame = makeFrame("SET_SPATIAL_REQUIREMENTS", 1, 64);
+
+    // previous path: vector copy into a tuple, queue copy, and a second copy out of the tuple
+    tbb::concurrent_queue<std::tuple<std::string, uint32_t, std::vector<char>>> tupleQueue;
+    size_t startCount = allocationCount;
+    for (size_t i = 0; i < numMessages; ++i) {
+        std::string eventName(frame.data(), std::min(std::strlen(frame.data()), (size_t) EVENT_NAME_LENGTH));
+        uint32_t requestId = *reinterpret_cast<uint32_t*>(frame.data() + EVENT_NAME_LENGTH);
+        std::vector<char> eventPayload(&frame[EVENT_HEADER_LENGTH], &frame[frame.size() - 1] + 1);
+        tupleQueue.push(std::make_tuple(eventName, requestId, eventPayload));
+        std::tuple<std::string, uint32_t, std::vector<char>> msg;
+        tupleQueue.try_pop(msg);
+        std::string name;
+        uint32_t id;
+        std::vector<char> payload;
+        std::tie(name, id, payload) = msg;
+    }
+    double tupleAllocations = double(allocationCount - startCount) / numMessages;
+
+    // pooled path, after one warm-up message
+    carta::EventMessagePool pool;
+    pool.create(carta::getEventType(frame.data(), EVENT_NAME_LENGTH), frame.data(), frame.size());
+    startCount = allocationCount;
+    for (size_t i = 0; i < numMessages; ++i) {
+        auto msg = pool.create(carta::getEventType(frame.data(), EVENT_NAME_LENGTH), frame.data(), frame.size());
+    }
+    double pooledAllocations = double(allocationCount - startCount) / numMessages;
+
+    std::cout << "Allocations per message: tuple queue " << tupleAllocations
+              << ", pooled envelope " << pooledAllocations << std::endl;
+    EXPECT_GT(tupleAllocations, 1.0);
+    EXPECT_EQ(pooledAllocations, 0.0);
+}
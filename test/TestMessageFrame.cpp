@@ -0,0 +1,56 @@
+#include "MessageFrame.h"
+#include <gtest/gtest.h>
+#include <google/protobuf/empty.pb.h>
+#include <google/protobuf/unknown_field_set.h>
+#include <google/protobuf/wrappers.pb.h>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace carta;
+
+TEST(TestMessageFrame, TestHeaderAndMessage) {
+    google::protobuf::StringValue message;
+    message.set_value("hello");
+    std::vector<char> frame(1000, 'x'); // reused buffer: stale contents must not leak into the header
+    writeMessageFrame(frame, "RASTER_IMAGE_DATA", 42, message);
+
+    ASSERT_EQ(frame.size(), EVENT_FRAME_HEADER_LENGTH + message.ByteSize());
+    EXPECT_STREQ(frame.data(), "RASTER_IMAGE_DATA");
+    EXPECT_EQ(frame[EVENT_FRAME_NAME_LENGTH - 1], 0);
+    uint32_t eventId;
+    std::memcpy(&eventId, frame.data() + EVENT_FRAME_NAME_LENGTH, sizeof(eventId));
+    EXPECT_EQ(eventId, 42);
+    for (int i = EVENT_FRAME_NAME_LENGTH + 4; i < EVENT_FRAME_HEADER_LENGTH; ++i) {
+        EXPECT_EQ(frame[i], 0);
+    }
+
+    google::protobuf::StringValue parsed;
+    ASSERT_TRUE(parsed.ParseFromArray(frame.data() + EVENT_FRAME_HEADER_LENGTH, frame.size() - EVENT_FRAME_HEADER_LENGTH));
+    EXPECT_EQ(parsed.value(), "hello");
+}
+
+TEST(TestMessageFrame, TestBytesFields) {
+    google::protobuf::StringValue message;
+    message.set_value("meta");
+    std::string band0(300, 'a'), band1(5, 'b'), nans(16, 'n');
+    std::vector<BytesField> fields = {{2, band0.data(), band0.size()}, {2, band1.data(), band1.size()},
+        {3, nans.data(), nans.size()}, {3, nullptr, 0}};
+    std::vector<char> frame;
+    writeMessageFrame(frame, "X", 1, message, fields);
+
+    // the appended fields parse as if they had been added to the message
+    google::protobuf::StringValue parsed;
+    ASSERT_TRUE(parsed.ParseFromArray(frame.data() + EVENT_FRAME_HEADER_LENGTH, frame.size() - EVENT_FRAME_HEADER_LENGTH));
+    EXPECT_EQ(parsed.value(), "meta");
+    google::protobuf::Empty fieldsOnly;
+    ASSERT_TRUE(fieldsOnly.ParseFromArray(frame.data() + EVENT_FRAME_HEADER_LENGTH, frame.size() - EVENT_FRAME_HEADER_LENGTH));
+    auto& unknown = fieldsOnly.GetReflection()->GetUnknownFields(fieldsOnly);
+    ASSERT_EQ(unknown.field_count(), 5); // value + 4 appended
+    EXPECT_EQ(unknown.field(1).number(), 2);
+    EXPECT_EQ(unknown.field(1).length_delimited(), band0);
+    EXPECT_EQ(unknown.field(2).length_delimited(), band1);
+    EXPECT_EQ(unknown.field(3).number(), 3);
+    EXPECT_EQ(unknown.field(3).length_delimited(), nans);
+    EXPECT_EQ(unknown.field(4).length_delimited(), "");
+}
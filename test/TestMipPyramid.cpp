@@ -0,0 +1,108 @@
+#include "MipPyramid.h"
+#include <gtest/gtest.h>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+using namespace carta;
+
+class TestMipPyramid : public ::testing::Test {
+protected:
+    void SetUp() override {
+        std::mt19937 rng(42);
+        std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+        image.resize(width * height);
+        for (auto& v : image) {
+            v = dist(rng);
+        }
+        // NaN blank region and scattered NaN/inf pixels
+        for (size_t j = 100; j < 180; ++j) {
+            for (size_t i = 40; i < 200; ++i) {
+                image[j * width + i] = NAN;
+            }
+        }
+        for (size_t k = 0; k < image.size(); k += 37) {
+            image[k] = (k % 2) ? NAN : INFINITY;
+        }
+    }
+
+    // direct NaN-aware block mean
+    float blockMean(int x, int y, int mip) {
+        double sum = 0;
+        int count = 0;
+        for (int j = y; j < y + mip; ++j) {
+            for (int i = x; i < x + mip; ++i) {
+                float v = image[j * width + i];
+                if (std::isfinite(v)) {
+                    sum += v;
+                    ++count;
+                }
+            }
+        }
+        return count ? sum / count : NAN;
+    }
+
+    void checkView(int x, int y, int mip, size_t nx, size_t ny) {
+        std::vector<float> output(nx * ny);
+        pyramid.blockMean(image.data(), width, height, x, y, mip, nx, ny, output.data());
+        for (size_t j = 0; j < ny; ++j) {
+            for (size_t i = 0; i < nx; ++i) {
+                float expected = blockMean(x + i * mip, y + j * mip, mip);
+                float actual = output[j * nx + i];
+                if (std::isnan(expected)) {
+                    EXPECT_TRUE(std::isnan(actual));
+                } else {
+                    EXPECT_NEAR(actual, expected, 1e-5) << "mip " << mip << " at " << i << "," << j;
+                }
+            }
+        }
+    }
+
+    const size_t width = 517, height = 389;
+    std::vector<float> image;
+    MipPyramid pyramid;
+};
+
+TEST_F(TestMipPyramid, TestAlignedViews) {
+    for (int mip : {1, 2, 4, 8, 16, 32}) {
+        checkView(0, 0, mip, width / mip, height / mip);
+    }
+    checkView(64, 32, 16, 20, 15);
+}
+
+TEST_F(TestMipPyramid, TestUnalignedViews) {
+    // offsets and mips not powers of 2 use the largest level that fits
+    checkView(6, 10, 12, 30, 20);
+    checkView(3, 5, 4, 100, 80);
+    checkView(0, 0, 3, width / 3, height / 3);
+}
+
+TEST_F(TestMipPyramid, TestLazyLevels) {
+    EXPECT_EQ(pyramid.getLevel(image.data(), width, height, 8)->width, width / 8);
+    auto level = pyramid.getLevel(image.data(), width, height, 4);
+    EXPECT_EQ(level->mip, 4);
+    EXPECT_EQ(level->height, height / 4);
+    pyramid.reset();
+    EXPECT_EQ(level->mip, 4); // still usable after reset
+}
+
+TEST_F(TestMipPyramid, TestNestedLevels) {
+    // tiles downsampled in parallel, each building the levels with parallel loops of its own:
+    // no thread waits for the pyramid while it may run other tiles
+    const int numTiles = 64;
+    std::vector<MipPyramid::level_ptr> levels(numTiles);
+    tbb::parallel_for(tbb::blocked_range<int>(0, numTiles), [&](const tbb::blocked_range<int>& r) {
+        for (int t = r.begin(); t != r.end(); ++t) {
+            levels[t] = pyramid.getLevel(image.data(), width, height, 8);
+        }
+    });
+    auto stored = pyramid.getLevel(image.data(), width, height, 8);
+    for (auto& level : levels) {
+        ASSERT_NE(level, nullptr);
+        EXPECT_EQ(level->mean.size(), stored->mean.size());
+        EXPECT_EQ(level->count, stored->count);
+    }
+    EXPECT_EQ(pyramid.getLevel(image.data(), width, height, 6), nullptr);
+}
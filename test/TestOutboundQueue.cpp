@@ -0,0 +1,115 @@
+#include "OutboundQueue.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace carta;
+
+static std::vector<char> makeMessage(char tag, size_t size) {
+    return std::vector<char>(size, tag);
+}
+
+static std::vector<char> popTags(OutboundQueue& queue) {
+    std::vector<char> tags, message;
+    while (queue.pop(message)) {
+        tags.push_back(message.empty() ? 0 : message[0]);
+    }
+    return tags;
+}
+
+TEST(TestOutboundQueue, TestFifo) {
+    OutboundQueue queue;
+    EXPECT_EQ(queue.push(makeMessage('a', 10)), 0);
+    queue.push(makeMessage('b', 20));
+    EXPECT_EQ(queue.size(), 2);
+    EXPECT_EQ(queue.queuedBytes(), 30);
+    EXPECT_EQ(popTags(queue), std::vector<char>({'a', 'b'}));
+    EXPECT_EQ(queue.queuedBytes(), 0);
+}
+
+TEST(TestOutboundQueue, TestSupersede) {
+    OutboundQueue queue;
+    queue.push(makeMessage('a', 10), DropPolicy::SUPERSEDE, 1);
+    queue.push(makeMessage('k', 10));
+    queue.push(makeMessage('x', 10), DropPolicy::SUPERSEDE, 2);
+    // replaces 'a' (same key), not 'x'
+    EXPECT_EQ(queue.push(makeMessage('b', 10), DropPolicy::SUPERSEDE, 1), 10);
+    EXPECT_EQ(queue.numDropped(), 1);
+    EXPECT_EQ(queue.droppedBytes(), 10);
+    EXPECT_EQ(popTags(queue), std::vector<char>({'k', 'x', 'b'}));
+
+    // a popped message is no longer superseded
+    queue.push(makeMessage('c', 10), DropPolicy::SUPERSEDE, 1);
+    std::vector<char> message;
+    ASSERT_TRUE(queue.pop(message));
+    EXPECT_EQ(queue.push(makeMessage('d', 10), DropPolicy::SUPERSEDE, 1), 0);
+}
+
+TEST(TestOutboundQueue, TestByteLimit) {
+    OutboundQueue queue(100);
+    queue.push(makeMessage('a', 40), DropPolicy::SUPERSEDE, 1);
+    queue.push(makeMessage('k', 40));
+    queue.push(makeMessage('b', 40), DropPolicy::SUPERSEDE, 2);
+    // over the limit: the oldest stale frame goes, the ack stays
+    EXPECT_EQ(queue.numDropped(), 1);
+    EXPECT_EQ(queue.queuedBytes(), 80);
+
+    // a new ack drops the remaining frame; acks are never dropped, even over the limit
+    queue.push(makeMessage('l', 40));
+    queue.push(makeMessage('m', 40));
+    EXPECT_EQ(queue.numDropped(), 2);
+    EXPECT_EQ(queue.queuedBytes(), 120);
+    EXPECT_EQ(popTags(queue), std::vector<char>({'k', 'l', 'm'}));
+
+    // a single message larger than the limit is still sent
+    queue.push(makeMessage('c', 500), DropPolicy::SUPERSEDE, 3);
+    EXPECT_EQ(popTags(queue), std::vector<char>({'c'}));
+}
+
+TEST(TestOutboundQueue, TestThrottle) {
+    OutboundQueue queue(100);
+    queue.push(makeMessage('a', 40), DropPolicy::SUPERSEDE, 1);
+    queue.push(makeMessage('t', 60), DropPolicy::THROTTLE);
+    // the stale frame makes room for bulk data
+    queue.push(makeMessage('u', 40), DropPolicy::THROTTLE);
+    EXPECT_EQ(queue.numDropped(), 1);
+    EXPECT_EQ(queue.queuedBytes(), 100);
+
+    // full of data that cannot be dropped: the sender waits for the client
+    std::atomic<bool> pushed(false);
+    std::thread sender([&] {
+        queue.push(makeMessage('v', 40), DropPolicy::THROTTLE);
+        pushed = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_FALSE(pushed);
+    EXPECT_EQ(queue.queuedBytes(), 100);
+
+    std::vector<char> message;
+    ASSERT_TRUE(queue.pop(message));
+    sender.join();
+    EXPECT_TRUE(pushed);
+    EXPECT_EQ(queue.numDropped(), 1);
+    EXPECT_EQ(popTags(queue), std::vector<char>({'u', 'v'}));
+
+    // a single message larger than the limit is sent once the queue is empty
+    queue.push(makeMessage('c', 500), DropPolicy::THROTTLE);
+    EXPECT_EQ(popTags(queue), std::vector<char>({'c'}));
+}
+
+TEST(TestOutboundQueue, TestClose) {
+    OutboundQueue queue(100);
+    queue.push(makeMessage('t', 80), DropPolicy::THROTTLE);
+    std::thread sender([&] { queue.push(makeMessage('u', 80), DropPolicy::THROTTLE); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    // the client is gone: waiting senders are released and nothing is sent
+    queue.close();
+    sender.join();
+    queue.push(makeMessage('k', 10));
+    EXPECT_EQ(queue.size(), 0);
+    EXPECT_EQ(queue.numDropped(), 3);
+    EXPECT_EQ(queue.droppedBytes(), 170);
+}
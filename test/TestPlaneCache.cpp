@@ -0,0 +1,88 @@
+#include "PlaneCache.h"
+#include <gtest/gtest.h>
+#include <vector>
+
+using namespace carta;
+
+using Plane = std::vector<float>;
+
+static PlaneCache<Plane>::plane_ptr makePlane(float value) {
+    return std::make_shared<Plane>(4, value);
+}
+
+TEST(TestPlaneCache, TestHitMiss) {
+    PlaneCache<Plane> cache(1000, 1000);
+    EXPECT_EQ(cache.get(1, 0, 0), nullptr);
+    auto plane = makePlane(1);
+    cache.put(1, 0, 0, plane, 100);
+    EXPECT_EQ(cache.get(1, 0, 0), plane);
+    EXPECT_EQ(cache.get(1, 0, 1), nullptr); // other stokes
+    EXPECT_EQ(cache.get(1, 1, 0), nullptr); // other channel
+    EXPECT_EQ(cache.get(2, 0, 0), nullptr); // other frame
+    EXPECT_EQ(cache.numHits(), 1);
+    EXPECT_EQ(cache.numMisses(), 4);
+    EXPECT_EQ(cache.usedBytes(), 100);
+    EXPECT_EQ(cache.usedBytes(1), 100);
+}
+
+TEST(TestPlaneCache, TestFlipBetweenChannels) {
+    PlaneCache<Plane> cache(1000, 200);
+    cache.put(1, 5, 0, makePlane(5), 100);
+    cache.put(1, 9, 0, makePlane(9), 100);
+    for (int i = 0; i < 10; ++i) {
+        int channel = (i % 2) ? 9 : 5;
+        auto plane = cache.get(1, channel, 0);
+        ASSERT_NE(plane, nullptr);
+        EXPECT_EQ((*plane)[0], channel);
+    }
+    EXPECT_EQ(cache.numEvictions(), 0);
+}
+
+TEST(TestPlaneCache, TestFrameShare) {
+    PlaneCache<Plane> cache(1000, 200);
+    cache.put(2, 0, 0, makePlane(0), 100);
+    for (int channel = 0; channel < 3; ++channel) {
+        cache.put(1, channel, 0, makePlane(channel), 100);
+    }
+    // frame 1 is limited to two planes: its oldest goes, not frame 2's
+    EXPECT_EQ(cache.usedBytes(1), 200);
+    EXPECT_EQ(cache.get(1, 0, 0), nullptr);
+    EXPECT_NE(cache.get(1, 2, 0), nullptr);
+    EXPECT_NE(cache.get(2, 0, 0), nullptr);
+    EXPECT_EQ(cache.numEvictions(), 1);
+}
+
+TEST(TestPlaneCache, TestGlobalBudget) {
+    PlaneCache<Plane> cache(300, 200);
+    cache.put(1, 0, 0, makePlane(0), 100);
+    cache.put(2, 0, 0, makePlane(0), 100);
+    cache.put(3, 0, 0, makePlane(0), 100);
+    EXPECT_NE(cache.get(1, 0, 0), nullptr); // frame 2 is now least recent
+    cache.put(3, 1, 0, makePlane(1), 100);
+    EXPECT_EQ(cache.usedBytes(), 300);
+    EXPECT_EQ(cache.numPlanes(), 3);
+    EXPECT_EQ(cache.get(2, 0, 0), nullptr);
+    EXPECT_EQ(cache.usedBytes(2), 0);
+    EXPECT_EQ(cache.numEvictions(), 1);
+}
+
+TEST(TestPlaneCache, TestReplaceAndEraseFrame) {
+    PlaneCache<Plane> cache(1000);
+    cache.put(1, 0, 0, makePlane(1), 100);
+    cache.put(1, 0, 0, makePlane(2), 100);
+    EXPECT_EQ(cache.usedBytes(), 100);
+    EXPECT_EQ((*cache.get(1, 0, 0))[0], 2);
+    cache.put(1, 1, 0, makePlane(1), 100);
+    cache.put(2, 1, 0, makePlane(1), 100);
+    cache.eraseFrame(1);
+    EXPECT_EQ(cache.usedBytes(), 100);
+    EXPECT_EQ(cache.numPlanes(), 1);
+    EXPECT_EQ(cache.get(1, 1, 0), nullptr);
+}
+
+TEST(TestPlaneCache, TestTooLarge) {
+    PlaneCache<Plane> cache(1000); // 250 per frame
+    cache.put(1, 0, 0, makePlane(0), 300);
+    EXPECT_EQ(cache.numPlanes(), 0);
+    EXPECT_EQ(cache.usedBytes(), 0);
+}
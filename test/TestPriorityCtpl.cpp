@@ -1,6 +1,12 @@
 #include "priority_ctpl.h"
 #include <gtest/gtest.h>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 template <typename T>
 void verify_pop_order(ctpl::detail::PriorityQueue<T> &pq,
@@ -73,3 +79,149 @@ TEST(TestPriorityQueue, TestNoRemove) {
 
     verify_pop_order<std::string>(pq, {"first", "second", "third"});
 }
+
+TEST(TestPriorityQueue, TestPushOrdered) {
+    ctpl::detail::PriorityQueue<std::string> pq;
+    pq.push_ordered(1, 1, "open");
+    pq.push_ordered(1, 0, "histogram");
+    pq.push(1, 1, "file list");
+    pq.push(2, 2, "other session");
+    pq.push(2, 1, "other session, low");
+    pq.push_ordered(1, 2, "cursor");
+
+    // the cursor starts after the session's earlier requests, which are raised to its priority
+    verify_pop_order<std::string>(pq, {"other session", "open", "histogram", "cursor", "file list", "other session, low"});
+}
+
+TEST(TestPriorityQueue, TestPushOrderedLower) {
+    ctpl::detail::PriorityQueue<std::string> pq;
+    pq.push_ordered(1, 2, "region");
+    pq.push_ordered(2, 0, "other session");
+    pq.push_ordered(1, 1, "spectral");
+    pq.push_ordered(1, 2, "remove region");
+
+    verify_pop_order<std::string>(pq, {"region", "spectral", "remove region", "other session"});
+    EXPECT_TRUE(pq.depths().empty());
+}
+
+TEST(TestPriorityQueue, TestPushAfterBarriers) {
+    ctpl::detail::PriorityQueue<std::string> pq;
+    pq.push_ordered(1, 0, "stats");
+    pq.push_after_barriers(1, 2, "cursor");
+    pq.push_ordered(1, 1, "open", true);
+    pq.push_ordered(1, 0, "histogram");
+    pq.push_after_barriers(1, 2, "view");
+    pq.push(2, 2, "other session");
+
+    // the queued heavy work does not delay the cursor; the view waits for the file opened
+    // before it, and so for the stats ordered before the file, but not for the histogram after it
+    verify_pop_order<std::string>(pq, {"cursor", "stats", "open", "view", "other session", "histogram"});
+}
+
+TEST(TestPriorityQueue, TestDepths) {
+    ctpl::detail::PriorityQueue<int> pq;
+    pq.push(1, 2, 1);
+    pq.push(1, 2, 2);
+    pq.push(2, 0, 3);
+
+    auto depths = pq.depths();
+    EXPECT_EQ(depths.size(), 2);
+    EXPECT_EQ(depths[2], 2);
+    EXPECT_EQ(depths[0], 1);
+    EXPECT_EQ(pq.size(), 3);
+}
+
+TEST(TestThreadPool, TestPriorityOrder) {
+    ctpl::thread_pool pool(1);
+    std::mutex mutex;
+    std::vector<std::string> order;
+
+    // block the only worker so the remaining tasks are queued before any of them runs
+    std::promise<void> started, release;
+    std::shared_future<void> released(release.get_future());
+    pool.push(0, 10, [&started, released](int) {
+        started.set_value();
+        released.wait();
+    });
+    started.get_future().wait();
+    auto record = [&mutex, &order](int, std::string name) {
+        std::unique_lock<std::mutex> guard(mutex);
+        order.push_back(name);
+    };
+    pool.push(0, 1, record, std::string("low"));
+    pool.push(0, 5, record, std::string("high"));
+    pool.push(1, 1, record, std::string("removed"));
+    pool.push(0, 3, record, std::string("medium"));
+    pool.remove_id(1);
+    EXPECT_EQ(pool.queue_size(), 3);
+
+    release.set_value();
+    pool.stop(true);
+    EXPECT_EQ(order, std::vector<std::string>({"high", "medium", "low"}));
+}
+
+// move-only, like a task holding a pooled message
+struct AddTask {
+    std::unique_ptr<int> value;
+    std::atomic<int>* sum;
+    void operator()(int) {
+        *sum += *value;
+    }
+};
+
+TEST(TestThreadPool, TestEnqueueMoveOnly) {
+    ctpl::thread_pool pool(2);
+    std::atomic<int> sum(0);
+    for (int i = 0; i < 10; ++i) {
+        pool.enqueue(0, i % 3, AddTask{std::unique_ptr<int>(new int(i)), &sum});
+    }
+    pool.stop(true);
+    EXPECT_EQ(sum, 45);
+}
+
+TEST(TestThreadPool, TestEnqueueOrdered) {
+    ctpl::thread_pool pool(1);
+    std::mutex mutex;
+    std::vector<int> order;
+    std::promise<void> started, release;
+    std::shared_future<void> released(release.get_future());
+    pool.push(1, 10, [&started, released](int) {
+        started.set_value();
+        released.wait();
+    });
+    started.get_future().wait();
+    for (int i = 0; i < 3; ++i) {
+        pool.enqueue_ordered(0, i, [&mutex, &order, i](int) {
+            std::unique_lock<std::mutex> guard(mutex);
+            order.push_back(i);
+        });
+    }
+    release.set_value();
+    pool.stop(true);
+    EXPECT_EQ(order, std::vector<int>({0, 1, 2}));
+}
+
+TEST(TestThreadPool, TestEnqueueAfterBarriers) {
+    ctpl::thread_pool pool(1);
+    std::mutex mutex;
+    std::vector<std::string> order;
+    std::promise<void> started, release;
+    std::shared_future<void> released(release.get_future());
+    pool.push(1, 10, [&started, released](int) {
+        started.set_value();
+        released.wait();
+    });
+    started.get_future().wait();
+    auto record = [&mutex, &order](std::string name) {
+        return [&mutex, &order, name](int) {
+            std::unique_lock<std::mutex> guard(mutex);
+            order.push_back(name);
+        };
+    };
+    // a session's heavy request queued behind a busy pool does not hold up its next cursor
+    pool.enqueue_ordered(0, 0, record("stats"));
+    pool.enqueue_after_barriers(0, 2, record("cursor"));
+    release.set_value();
+    pool.stop(true);
+    EXPECT_EQ(order, std::vector<std::string>({"cursor", "stats"}));
+}
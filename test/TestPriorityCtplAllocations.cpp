@@ -0,0 +1,49 @@
+#include "priority_ctpl.h"
+#include "AllocationCounter.h" // to compare enqueue with push
+#include <gtest/gtest.h>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+// holds a shared handle, like a task holding the session entry
+struct CountTask {
+    std::shared_ptr<int> entry;
+    std::atomic<int>* done;
+    void operator()(int) {
+        ++*done;
+    }
+};
+
+TEST(TestThreadPool, TestEnqueueAllocations) {
+    const int numTasks = 10000;
+    ctpl::thread_pool pool(1);
+    auto entry = std::make_shared<int>(0);
+    std::atomic<int> done(0);
+    // one task at a time, so the queue never needs more nodes than after the warm-up
+    auto run = [&](int count, bool withFuture) {
+        for (int i = 0; i < count; ++i) {
+            int target = done + 1;
+            if (withFuture) {
+                pool.push(0, i % 3, CountTask{entry, &done});
+            } else {
+                pool.enqueue(0, i % 3, CountTask{entry, &done});
+            }
+            while (done < target) {
+                std::this_thread::yield();
+            }
+        }
+    };
+
+    run(10, false);
+    size_t startCount = allocationCount;
+    run(numTasks, true);
+    double pushAllocations = double(allocationCount - startCount) / numTasks;
+    startCount = allocationCount;
+    run(numTasks, false);
+    double enqueueAllocations = double(allocationCount - startCount) / numTasks;
+
+    std::cout << "Allocations per task: push " << pushAllocations << ", enqueue " << enqueueAllocations << std::endl;
+    EXPECT_GE(pushAllocations, 1.0);
+    EXPECT_EQ(enqueueAllocations, 0.0);
+}
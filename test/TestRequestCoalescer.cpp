@@ -0,0 +1,96 @@
+#include "RequestCoalescer.h"
+#include <gtest/gtest.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <google/protobuf/wire_format_lite.h>
+#include <string>
+
+using namespace carta;
+using google::protobuf::internal::WireFormatLite;
+
+// SET_IMAGE_VIEW payload: sfixed32 file_id = 1, ImageBounds image_bounds = 2, sfixed32 mip = 3
+static std::string makeView(int32_t fileId, bool fileIdFirst = true) {
+    std::string payload;
+    {
+        google::protobuf::io::StringOutputStream stream(&payload);
+        google::protobuf::io::CodedOutputStream output(&stream);
+        if (fileIdFirst) {
+            WireFormatLite::WriteSFixed32(1, fileId, &output);
+        }
+        output.WriteTag(WireFormatLite::MakeTag(2, WireFormatLite::WIRETYPE_LENGTH_DELIMITED));
+        output.WriteVarint32(10);
+        for (int field = 1; field <= 2; ++field) {
+            WireFormatLite::WriteSFixed32(field, 512, &output);
+        }
+        WireFormatLite::WriteSFixed32(3, 4, &output);
+        if (!fileIdFirst) {
+            WireFormatLite::WriteSFixed32(1, fileId, &output);
+        }
+    }
+    return payload;
+}
+
+TEST(TestRequestCoalescer, TestLatestWins) {
+    RequestCoalescer coalescer;
+    auto first = coalescer.stamp(EventType::SET_CURSOR, 0, 11);
+    auto second = coalescer.stamp(EventType::SET_CURSOR, 0, 12);
+    EXPECT_LT(first, second);
+    EXPECT_FALSE(coalescer.isLatest(EventType::SET_CURSOR, 0, first));
+    EXPECT_TRUE(coalescer.isLatest(EventType::SET_CURSOR, 0, second));
+    EXPECT_EQ(coalescer.latestRequestId(EventType::SET_CURSOR, 0), 12);
+    EXPECT_EQ(coalescer.numSuperseded(), 1);
+}
+
+TEST(TestRequestCoalescer, TestKeys) {
+    RequestCoalescer coalescer;
+    auto cursor = coalescer.stamp(EventType::SET_CURSOR, 0, 1);
+    auto view = coalescer.stamp(EventType::SET_IMAGE_VIEW, 0, 2);
+    auto otherFile = coalescer.stamp(EventType::SET_CURSOR, 1, 3);
+    auto noFile = coalescer.stamp(EventType::SET_CURSOR, -1, 4);
+    // a view or another file's cursor does not supersede a cursor
+    EXPECT_TRUE(coalescer.isLatest(EventType::SET_CURSOR, 0, cursor));
+    EXPECT_TRUE(coalescer.isLatest(EventType::SET_IMAGE_VIEW, 0, view));
+    EXPECT_TRUE(coalescer.isLatest(EventType::SET_CURSOR, 1, otherFile));
+    EXPECT_TRUE(coalescer.isLatest(EventType::SET_CURSOR, -1, noFile));
+    EXPECT_EQ(coalescer.numSuperseded(), 0);
+    // never stamped
+    EXPECT_TRUE(coalescer.isLatest(EventType::SET_IMAGE_VIEW, 5, 1));
+    EXPECT_EQ(coalescer.latestRequestId(EventType::SET_IMAGE_VIEW, 5), 0);
+}
+
+TEST(TestRequestCoalescer, TestReadFileId) {
+    int32_t fileId(-100);
+    auto payload = makeView(3);
+    ASSERT_TRUE(RequestCoalescer::readFileId(payload.data(), payload.size(), fileId));
+    EXPECT_EQ(fileId, 3);
+    payload = makeView(-1, false);
+    ASSERT_TRUE(RequestCoalescer::readFileId(payload.data(), payload.size(), fileId));
+    EXPECT_EQ(fileId, -1);
+    // proto3 omits a zero file id
+    payload = makeView(0);
+    payload.erase(0, 5);
+    ASSERT_TRUE(RequestCoalescer::readFileId(payload.data(), payload.size(), fileId));
+    EXPECT_EQ(fileId, 0);
+    ASSERT_TRUE(RequestCoalescer::readFileId(payload.data(), 0, fileId));
+    EXPECT_EQ(fileId, 0);
+}
+
+TEST(TestRequestCoalescer, TestReadFileIdVarint) {
+    std::string payload;
+    {
+        google::protobuf::io::StringOutputStream stream(&payload);
+        google::protobuf::io::CodedOutputStream output(&stream);
+        WireFormatLite::WriteInt32(1, -7, &output);
+    }
+    int32_t fileId(0);
+    ASSERT_TRUE(RequestCoalescer::readFileId(payload.data(), payload.size(), fileId));
+    EXPECT_EQ(fileId, -7);
+}
+
+TEST(TestRequestCoalescer, TestReadFileIdMalformed) {
+    int32_t fileId(9);
+    auto payload = makeView(3, false);
+    EXPECT_FALSE(RequestCoalescer::readFileId(payload.data(), payload.size() - 2, fileId));
+    EXPECT_FALSE(RequestCoalescer::readFileId(payload.data(), 8, fileId));
+    EXPECT_EQ(fileId, 9);
+}
@@ -0,0 +1,79 @@
+#include "TaskContexts.h"
+#include <gtest/gtest.h>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_reduce.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using namespace carta;
+
+// Slow sum standing in for a cube histogram reduction
+struct SlowSum {
+    std::atomic<size_t>& chunks;
+    size_t sum;
+
+    SlowSum(std::atomic<size_t>& c) : chunks(c), sum(0) {}
+    SlowSum(SlowSum& other, tbb::split) : chunks(other.chunks), sum(0) {}
+
+    void operator()(const tbb::blocked_range<size_t>& r) {
+        ++chunks;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        for (size_t i = r.begin(); i != r.end(); ++i) {
+            sum += i;
+        }
+    }
+    void join(SlowSum& other) {
+        sum += other.sum;
+    }
+};
+
+TEST(TestTaskContexts, TestStartCancelsPrevious) {
+    TaskContexts contexts;
+    auto first = contexts.start(0, 1, TaskContexts::HISTOGRAM);
+    auto other = contexts.start(0, 1, TaskContexts::STATS);
+    auto second = contexts.start(0, 1, TaskContexts::HISTOGRAM);
+    EXPECT_TRUE(first->is_group_execution_cancelled());
+    EXPECT_FALSE(other->is_group_execution_cancelled());
+    EXPECT_FALSE(second->is_group_execution_cancelled());
+
+    EXPECT_TRUE(contexts.finish(0, 1, TaskContexts::HISTOGRAM, first));
+    EXPECT_FALSE(contexts.finish(0, 1, TaskContexts::HISTOGRAM, second));
+    EXPECT_EQ(contexts.numCancelled(), 1);
+}
+
+TEST(TestTaskContexts, TestCancelRegionAndFile) {
+    TaskContexts contexts;
+    auto region1 = contexts.start(0, 1, TaskContexts::SPECTRAL);
+    auto region2 = contexts.start(0, 2, TaskContexts::SPECTRAL);
+    auto file1 = contexts.start(1, 1, TaskContexts::SPECTRAL);
+    contexts.cancelRegion(0, 1);
+    EXPECT_TRUE(region1->is_group_execution_cancelled());
+    EXPECT_FALSE(region2->is_group_execution_cancelled());
+    EXPECT_FALSE(file1->is_group_execution_cancelled());
+    contexts.cancelFile(0);
+    EXPECT_TRUE(region2->is_group_execution_cancelled());
+    EXPECT_FALSE(file1->is_group_execution_cancelled());
+    contexts.cancelAll();
+    EXPECT_TRUE(file1->is_group_execution_cancelled());
+}
+
+TEST(TestTaskContexts, TestCancelReduction) {
+    TaskContexts contexts;
+    const size_t N = 1 << 20;
+    std::atomic<size_t> chunks(0);
+    auto context = contexts.start(0, 1, TaskContexts::HISTOGRAM);
+    std::thread worker([&]() {
+        SlowSum body(chunks);
+        tbb::parallel_reduce(tbb::blocked_range<size_t>(0, N, 1024), body, *context);
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    auto tCancel = std::chrono::high_resolution_clock::now();
+    contexts.start(0, 1, TaskContexts::HISTOGRAM); // superseded
+    worker.join();
+    auto dt = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - tCancel);
+
+    EXPECT_TRUE(contexts.finish(0, 1, TaskContexts::HISTOGRAM, context));
+    EXPECT_LT(chunks.load(), N / 1024);
+    EXPECT_LT(dt.count(), 100);
+}
@@ -0,0 +1,56 @@
+#include "Tile.h"
+#include <gtest/gtest.h>
+#include <unordered_set>
+
+using namespace carta;
+
+TEST(TestTile, TestTilesForView) {
+    // 1000x600 view at mip 2: tiles cover 512 image pixels
+    auto tiles = Tile::getTiles(0, 1000, 0, 600, 2);
+    ASSERT_EQ(tiles.size(), 4);
+    std::unordered_set<uint64_t> codes;
+    for (auto& tile : tiles) {
+        EXPECT_EQ(tile.mip, 2);
+        codes.insert(tile.encode());
+    }
+    EXPECT_EQ(codes.size(), 4);
+
+    // panning by less than a tile needs at most one new column of tiles
+    auto panned = Tile::getTiles(300, 1300, 0, 600, 2);
+    int missing(0);
+    for (auto& tile : panned) {
+        missing += codes.count(tile.encode()) ? 0 : 1;
+    }
+    EXPECT_EQ(missing, 2);
+
+    // nearest to the view center first
+    auto centered = Tile::getTiles(200, 600, 200, 600, 1);
+    ASSERT_EQ(centered.size(), 9);
+    EXPECT_EQ(centered[0].x, 1);
+    EXPECT_EQ(centered[0].y, 1);
+
+    EXPECT_TRUE(Tile::getTiles(0, 0, 0, 100, 1).empty());
+}
+
+TEST(TestTile, TestBounds) {
+    int xMin, xMax, yMin, yMax;
+    Tile inner{0, 0, 1};
+    EXPECT_TRUE(inner.getBounds(1000, 600, xMin, xMax, yMin, yMax));
+    EXPECT_EQ(xMin, 0);
+    EXPECT_EQ(xMax, TILE_SIZE);
+    EXPECT_EQ(yMax, TILE_SIZE);
+
+    // clipped to the image and to whole mip blocks
+    Tile edge{1, 0, 4};
+    EXPECT_TRUE(edge.getBounds(1500, 600, xMin, xMax, yMin, yMax));
+    EXPECT_EQ(xMin, 1024);
+    EXPECT_EQ(xMax, 1500);
+    EXPECT_EQ(yMax, 600);
+    Tile odd{1, 0, 3};
+    EXPECT_TRUE(odd.getBounds(1000, 600, xMin, xMax, yMin, yMax));
+    EXPECT_EQ(xMin, 768);
+    EXPECT_EQ(xMax, 999);
+
+    Tile outside{2, 0, 4};
+    EXPECT_FALSE(outside.getBounds(1500, 600, xMin, xMax, yMin, yMax));
+}
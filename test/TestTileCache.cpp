@@ -0,0 +1,91 @@
+#include "TileCache.h"
+#include <gtest/gtest.h>
+
+using namespace carta;
+
+static TileCacheKey makeKey(const std::string& filename, uint64_t tile, int channel = 0) {
+    return TileCacheKey{filename, "0", channel, 0, tile, 1, 0, 11, 1};
+}
+
+static TileCache::tile_ptr makeTile(size_t size) {
+    auto tile = std::make_shared<CompressedTile>();
+    tile->imageData.resize(size, 1);
+    return tile;
+}
+
+TEST(TestTileCache, TestHitMiss) {
+    TileCache cache(1000);
+    EXPECT_EQ(cache.get(makeKey("a.fits", 1), 10), nullptr);
+    auto tile = makeTile(100);
+    cache.put(makeKey("a.fits", 1), 10, tile);
+    EXPECT_EQ(cache.get(makeKey("a.fits", 1), 10), tile);
+    EXPECT_EQ(cache.get(makeKey("a.fits", 1, 1), 10), nullptr); // other channel
+    EXPECT_EQ(cache.get(makeKey("b.fits", 1), 10), nullptr);    // other file
+    EXPECT_EQ(cache.numHits(), 1);
+    EXPECT_EQ(cache.numMisses(), 3);
+    EXPECT_EQ(cache.usedBytes(), 100);
+}
+
+TEST(TestTileCache, TestFractionalQuality) {
+    TileCache cache(1000);
+    auto rate = [](float quality) {
+        auto key = makeKey("a.fits", 1);
+        key.mode = 1; // ZFP rate
+        key.quality = quality;
+        return key;
+    };
+    auto tile = makeTile(100);
+    cache.put(rate(2.5f), 10, tile);
+    // rates that round to the same integer are different tiles
+    EXPECT_EQ(cache.get(rate(2.0f), 10), nullptr);
+    EXPECT_EQ(cache.get(rate(2.75f), 10), nullptr);
+    EXPECT_EQ(cache.get(rate(2.5f), 10), tile);
+    EXPECT_EQ(TileCacheKeyHash()(rate(2.5f)), TileCacheKeyHash()(rate(2.5f)));
+}
+
+TEST(TestTileCache, TestEvictLeastRecentlyUsed) {
+    TileCache cache(300);
+    for (uint64_t i = 0; i < 3; ++i) {
+        cache.put(makeKey("a.fits", i), 10, makeTile(100));
+    }
+    EXPECT_NE(cache.get(makeKey("a.fits", 0), 10), nullptr); // 1 is now least recent
+    cache.put(makeKey("a.fits", 3), 10, makeTile(100));
+    EXPECT_EQ(cache.numTiles(), 3);
+    EXPECT_EQ(cache.usedBytes(), 300);
+    EXPECT_EQ(cache.get(makeKey("a.fits", 1), 10), nullptr);
+    EXPECT_NE(cache.get(makeKey("a.fits", 0), 10), nullptr);
+    EXPECT_NE(cache.get(makeKey("a.fits", 2), 10), nullptr);
+
+    // larger than the budget: not cached
+    cache.put(makeKey("a.fits", 4), 10, makeTile(400));
+    EXPECT_EQ(cache.get(makeKey("a.fits", 4), 10), nullptr);
+    EXPECT_EQ(cache.numTiles(), 3);
+}
+
+TEST(TestTileCache, TestModifiedFile) {
+    TileCache cache(1000);
+    cache.put(makeKey("a.fits", 0), 10, makeTile(100));
+    cache.put(makeKey("a.fits", 1), 10, makeTile(100));
+    cache.put(makeKey("b.fits", 0), 10, makeTile(100));
+    EXPECT_EQ(cache.get(makeKey("a.fits", 0), 11), nullptr);
+    EXPECT_EQ(cache.numTiles(), 1);
+    EXPECT_NE(cache.get(makeKey("b.fits", 0), 10), nullptr);
+}
+
+TEST(TestTileCache, TestPruneFiles) {
+    TileCache cache(200);
+    EXPECT_EQ(cache.get(makeKey("a.fits", 0), 10), nullptr);
+    EXPECT_EQ(cache.numFiles(), 0); // a miss does not track the file
+    cache.put(makeKey("a.fits", 0), 10, makeTile(100));
+    cache.put(makeKey("a.fits", 1), 10, makeTile(100));
+    EXPECT_EQ(cache.numFiles(), 1);
+    // evicting the last tile of a file drops it
+    cache.put(makeKey("b.fits", 0), 10, makeTile(100));
+    cache.put(makeKey("c.fits", 0), 10, makeTile(100));
+    EXPECT_EQ(cache.numFiles(), 2);
+    EXPECT_EQ(cache.numTiles(), 2);
+    // modified: its tiles and the file are dropped
+    EXPECT_EQ(cache.get(makeKey("b.fits", 0), 11), nullptr);
+    EXPECT_EQ(cache.numFiles(), 1);
+    EXPECT_EQ(cache.usedBytes(), 100);
+}